@@ -48,6 +48,21 @@ struct queue_entry *queue_peek_front(struct queue *q) {
     return STAILQ_FIRST(q);
 }
 
+void queue_concat(struct queue *q1, struct queue *q2) {
+    STAILQ_CONCAT(q1, q2);
+}
+
+int queue_remove(struct queue *q, struct queue_entry *e) {
+    struct queue_entry *elem;
+    STAILQ_FOREACH(elem, q, entries) {
+        if (elem == e) {
+            STAILQ_REMOVE(q, e, queue_entry, entries);
+            return 1;
+        }
+    }
+    return 0;
+}
+
 struct queue_entry *queue_pop_head(struct queue *q) {
     struct queue_entry *elem = queue_peek_front(q);
     if(elem) {
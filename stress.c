@@ -0,0 +1,200 @@
+#define _GNU_SOURCE
+#include "sut.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+
+// Usage: stress [tasks] [window]
+// Runs tasks workers, at most window of them alive at once, mixing yields, nested sut_create and file I/O, and
+// reports throughput, yield latency percentiles, peak RSS and allocations left live after sut_shutdown.
+// Link with -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc,--wrap=free so allocations can be counted.
+
+#define YIELDS 4
+// Every NESTED_EVERY-th worker creates a child task, and every IO_EVERY-th does a round of file I/O
+#define NESTED_EVERY 10
+#define IO_EVERY 100
+#define MAX_SAMPLES (1 << 20)
+
+long tasks = 10000;
+long window = 1000;
+long started, nested, failed, io_ops, io_errors;
+long samples[MAX_SAMPLES];
+long sample_count, yields;
+
+// Allocations made by the runtime and this harness that haven't been freed; libc's own aren't wrapped
+long live_allocations;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+
+void *__wrap_malloc(const size_t size) {
+    void *const ptr = __real_malloc(size);
+    if (ptr != NULL) {
+        __atomic_add_fetch(&live_allocations, 1, __ATOMIC_RELAXED);
+    }
+    return ptr;
+}
+
+void *__wrap_calloc(const size_t count, const size_t size) {
+    void *const ptr = __real_calloc(count, size);
+    if (ptr != NULL) {
+        __atomic_add_fetch(&live_allocations, 1, __ATOMIC_RELAXED);
+    }
+    return ptr;
+}
+
+void *__wrap_realloc(void *const ptr, const size_t size) {
+    void *const result = __real_realloc(ptr, size);
+    if (ptr == NULL && result != NULL) {
+        __atomic_add_fetch(&live_allocations, 1, __ATOMIC_RELAXED);
+    } else if (ptr != NULL && size == 0) {
+        __atomic_sub_fetch(&live_allocations, 1, __ATOMIC_RELAXED);
+    }
+    return result;
+}
+
+void __wrap_free(void *const ptr) {
+    if (ptr != NULL) {
+        __atomic_sub_fetch(&live_allocations, 1, __ATOMIC_RELAXED);
+    }
+    __real_free(ptr);
+}
+
+long clock_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+/**
+ * Record how long a yield took to come back, keeping a uniform sample once the buffer is full.
+ */
+void record(const long ns) {
+    yields++;
+    if (sample_count < MAX_SAMPLES) {
+        samples[sample_count++] = ns;
+    } else {
+        const long slot = random() % yields;
+        if (slot < MAX_SAMPLES) {
+            samples[slot] = ns;
+        }
+    }
+}
+
+void warm_up() {
+    sut_exit();
+}
+
+void child() {
+    const long t0 = clock_ns();
+    sut_yield();
+    record(clock_ns() - t0);
+    sut_exit();
+}
+
+void do_io(const long id) {
+    char sbuf[128];
+    const int fd = sut_open_ex("./stress.txt", O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (fd < 0) {
+        io_errors++;
+        return;
+    }
+    const int length = snprintf(sbuf, sizeof(sbuf), "Hello world!, message from stress task %ld \n", id);
+    if (sut_write(fd, sbuf, length) != length) {
+        io_errors++;
+    }
+    if (sut_pread(fd, sbuf, length, 0) < 0) {
+        io_errors++;
+    }
+    sut_close(fd);
+    io_ops += 4;
+}
+
+void worker() {
+    const long id = started++;
+    int i;
+    for (i = 0; i < YIELDS; i++) {
+        const long t0 = clock_ns();
+        sut_yield();
+        record(clock_ns() - t0);
+    }
+    if (id % NESTED_EVERY == 0) {
+        if (sut_create(child)) {
+            nested++;
+        } else {
+            failed++;
+        }
+    }
+    if (id % IO_EVERY == 0) {
+        do_io(id);
+    }
+    sut_exit();
+}
+
+/**
+ * Spawn the workers in waves of window tasks, so that how many are alive at once is bounded by choice rather than
+ * by whatever the runtime runs out of first.
+ */
+void driver() {
+    long spawned = 0;
+    while (spawned < tasks) {
+        struct sut_group *const group = sut_group_create();
+        long i;
+        for (i = 0; i < window && spawned < tasks; i++, spawned++) {
+            if (sut_group_spawn(group, worker) == NULL) {
+                failed++;
+            }
+        }
+        sut_group_wait(group);
+        sut_group_destroy(group);
+    }
+    sut_exit();
+}
+
+int compare_long(const void *a, const void *b) {
+    const long x = *(const long *) a, y = *(const long *) b;
+    return (x > y) - (x < y);
+}
+
+long percentile(const double p) {
+    return sample_count == 0 ? 0 : samples[(long) (p * (sample_count - 1))];
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1) {
+        tasks = atol(argv[1]);
+    }
+    if (argc > 2) {
+        window = atol(argv[2]);
+    }
+    printf("stress: %ld tasks, %ld at a time\n", tasks, window);
+
+    // A one task run first, so that anything the runtime sets up once and keeps is already there
+    sut_init();
+    sut_create(warm_up);
+    sut_shutdown();
+    const long live_before = __atomic_load_n(&live_allocations, __ATOMIC_RELAXED);
+    const long t0 = clock_ns();
+    sut_init();
+    sut_create(driver);
+    sut_shutdown();
+    const double seconds = (clock_ns() - t0) / 1e9;
+    const long leaked = __atomic_load_n(&live_allocations, __ATOMIC_RELAXED) - live_before;
+
+    qsort(samples, sample_count, sizeof(long), compare_long);
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    printf("tasks:     %ld run, %ld nested, %ld failed to start\n", started, nested, failed);
+    printf("time:      %.3f s, %.0f tasks/s, %.0f yields/s, %ld I/O ops (%ld errors)\n", seconds,
+           (started + nested) / seconds, yields / seconds, io_ops, io_errors);
+    printf("yield ns:  p50 %ld, p99 %ld, p99.9 %ld, max %ld\n", percentile(0.5), percentile(0.99),
+           percentile(0.999), percentile(1));
+    printf("peak RSS:  %ld KiB\n", usage.ru_maxrss);
+    printf("leaked:    %ld allocations\n", leaked);
+    return failed > 0 || io_errors > 0 || leaked != 0;
+}
@@ -1,257 +1,1560 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <errno.h>
+#include <poll.h>
 #include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
 #include <ucontext.h>
 #include <unistd.h>
+#include <sys/eventfd.h>
 #include <sys/fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 #include "sut.h"
+#include "sut_arena.h"
+#include "sut_iobuf.h"
+#include "sut_sim.h"
+#include "sut_stack.h"
+#include "sut_watchdog.h"
 #include "queue.h"
 
-pthread_t *c_exec, *i_exec;
-pthread_mutex_t exec_lock, io_lock, sem_lock;
-struct queue exec_queue, io_queue;
-ucontext_t *c_exec_context, *i_exec_context;
-int sem;
-bool is_doing_work;
+/**
+ * What a task asked the c_exec scheduler to do when it last switched back to it.
+ */
+enum task_action {
+    TASK_EXIT,
+    TASK_YIELD,
+    TASK_IO,
+    TASK_PARK,
+};
+
+/**
+ * Where a task currently is, so that handoffs and wakeups can tell whether it may be switched to.
+ */
+enum task_state {
+    TASK_READY,
+    TASK_RUNNING,
+    TASK_PARKED,
+    TASK_WAITING_IO,
+};
+
+/**
+ * A request for the i_exec thread to run fn(arg) on its own stack.
+ * It lives on the stack of the task that issued it, which stays parked until the result is posted.
+ */
+struct io_request {
+    sut_offload_f fn;
+    void *arg;
+    long result;
+    struct sut_task *task;
+    // The descriptor it works on, or -1, and what it costs against its flow's deficit
+    int fd;
+    int cost;
+    enum sut_io_priority priority;
+    struct queue_entry node;
+};
+
+/**
+ * The requests the i_exec thread has for one descriptor in one priority class, served by deficit round-robin.
+ */
+struct io_flow {
+    struct queue requests;
+    long deficit;
+    bool active;
+    struct queue_entry node;
+};
+
+/**
+ * The arguments of a read or write, passed through sut_offload. The offset is only used by pread and pwrite.
+ */
+struct io_args {
+    int fd;
+    char *buf;
+    int size;
+    off_t offset;
+};
+
+/**
+ * The arguments of sut_open_ex.
+ */
+struct open_args {
+    const char *file_name;
+    int flags;
+    mode_t mode;
+};
+
+/**
+ * The arguments of sut_stat.
+ */
+struct stat_args {
+    const char *file_name;
+    struct stat *st;
+};
+
+/**
+ * Where a stackless task keeps its I/O request, since it has no stack of its own to park it on.
+ */
+struct step_io {
+    struct io_request request;
+    struct io_args args;
+};
+
+/**
+ * A set of tasks that can be waited on and cancelled together.
+ */
+struct sut_group {
+    // Members that haven't exited yet; spawning may happen off the c_exec thread, so this is atomic
+    int live;
+    // live plus one for the handle, so that a group destroyed while members run is freed by the last of them
+    int refs;
+    bool cancelled;
+    // Tasks parked in sut_group_wait, woken together when live drops to 0. Only touched on the c_exec thread.
+    struct group_waiter *waiters;
+};
+
+/**
+ * A task parked in sut_group_wait. Lives on the waiting task's stack, so any number of tasks can wait.
+ */
+struct group_waiter {
+    struct sut_task *task;
+    struct group_waiter *next;
+    bool queued;
+};
+
+/**
+ * Where threads outside the runtime post values for a task. Posting only uses atomics, so it is safe from any
+ * thread or signal handler; a mailbox is put on the posted list at most once until the scheduler drains it.
+ */
+struct sut_mailbox {
+    unsigned long value;
+    bool queued;
+    struct sut_mailbox *next_posted;
+    struct sut_task *waiter;
+};
+
+/**
+ * A task control block. The node is what gets queued, so scheduling a task never allocates.
+ * A stackful task's context lives at the top of its stack, so a task that hasn't run yet is only this descriptor.
+ */
+struct sut_task {
+    struct queue_entry node;
+    unsigned long id;
+    void *entry;
+    enum task_action action;
+    enum task_state state;
+    struct io_request *request;
+    struct stack stack;
+    sut_step_f step;
+    void *step_state;
+    void **locals;
+    struct arena_chunk *arena;
+    struct sut_group *group;
+    enum sut_io_priority io_priority;
+    union {
+        ucontext_t *context;
+        struct step_io step_io;
+    };
+};
+
+// Room for a context at the top of a stack, keeping what is below it aligned
+#define CONTEXT_SPACE ((sizeof(ucontext_t) + 63) & ~(size_t) 63)
+
+#define CACHE_LINE 64
+
+/**
+ * The compute executor's state. Each group of fields starts on its own cache line, so that threads queueing tasks,
+ * the scheduler running them, and readers of the cold fields don't bounce one line between cores.
+ */
+struct compute_executor {
+    // Written by every thread that makes a task runnable, including the lock-free list of posted mailboxes and the
+    // eventfd that wakes the c_exec thread when one is posted
+    _Alignas(CACHE_LINE) pthread_mutex_t lock;
+    struct queue queue;
+    size_t queued;
+    struct sut_mailbox *posted;
+    int wake_fd;
+    // Only touched by the thread running the scheduler, which includes the sem-like count of outstanding I/O, and
+    // the batch of runnable tasks it last took from the queue
+    _Alignas(CACHE_LINE) struct sut_task *current;
+    struct queue batch;
+    int sem;
+    int mailbox_waiters;
+    // Stackful tasks that have been given a stack and haven't exited yet
+    int live_stacks;
+    struct sut_stack_stats stack_stats;
+    struct sut_io_stats io_stats;
+    struct sut_exec_stats exec_stats;
+    // Per descriptor, which of NOWAIT_READ and NOWAIT_WRITE the kernel has refused or would block on anyway, so they
+    // aren't tried inline
+    unsigned char *nowait_unsupported;
+    int nowait_capacity;
+    ucontext_t context;
+    // Written once, read by the i_exec thread on every loop to know when to stop
+    _Alignas(CACHE_LINE) pthread_t *thread;
+};
+
+/**
+ * The I/O executor's state, split the same way.
+ */
+struct io_executor {
+    // Written by the c_exec thread each time it submits a request
+    _Alignas(CACHE_LINE) pthread_mutex_t lock;
+    struct queue queue;
+    // Only used by the thread running the I/O steps, which moves submitted requests out of the queue into these
+    _Alignas(CACHE_LINE) struct io_flow **flows[SUT_IO_CLASSES];
+    int flow_capacity[SUT_IO_CLASSES];
+    struct queue active_flows[SUT_IO_CLASSES];
+    int scheduled;
+    struct sut_exec_stats exec_stats;
+    // Written by the i_exec thread when it goes idle or gets busy, read by the c_exec thread when it runs out of work
+    _Alignas(CACHE_LINE) bool is_doing_work;
+    pthread_t *thread;
+};
+
+struct compute_executor compute;
+struct io_executor io;
+struct sut_attr attr;
+unsigned long task_count;
+void (*key_destructors[SUT_KEYS_MAX])(void *);
+int key_count;
 
 #define STACK_SIZE (1024*1024)
+// A flow's deficit grows by this many bytes per round, and every request costs a fixed amount plus its bytes
+#define IO_QUANTUM (64*1024)
+#define IO_OP_COST 4096
+#define IO_BUF_SIZE (64*1024)
+#define NOWAIT_READ 1
+#define NOWAIT_WRITE 2
+
+static long io_fsync(void *arg);
+static long io_fdatasync(void *arg);
+
+/**
+ * Insert a task's node into the exec queue and mark the task ready. The state is only set here, under the lock, so
+ * a task seen as ready is always in the exec queue or the scheduler's batch.
+ * @param node The queue_entry to insert.
+ */
+void insert_node_in_exec_queue(struct queue_entry *const node) {
+    pthread_mutex_lock(&compute.lock);
+    ((struct sut_task *) node->data)->state = TASK_READY;
+    queue_insert_tail(&compute.queue, node);
+    compute.queued++;
+    pthread_mutex_unlock(&compute.lock);
+}
+
+/**
+ * Hand a parked task's request to the i_exec thread.
+ * This runs on the c_exec scheduler after the task has switched out, so the i_exec thread can never
+ * resume a task whose context is still being saved.
+ * @param request The request to queue.
+ */
+void submit_io_request(struct io_request *const request) {
+    // Increment the semaphore. Only the c_exec scheduler counts outstanding I/O, so it needs no lock
+    compute.sem++;
+
+    pthread_mutex_lock(&io.lock);
+    queue_insert_tail(&io.queue, &request->node);
+    pthread_mutex_unlock(&io.lock);
+}
+
+/**
+ * Decrement the semaphore.
+ */
+void decrement_sem() {
+    compute.sem--;
+}
+
+/**
+ * Find the NUMA node a CPU belongs to.
+ * @param cpu The CPU to look up.
+ * @return The node number, or -1 if it can't be determined.
+ */
+int cpu_to_node(const int cpu) {
+    for (int node = 0; node < 1024; node++) {
+        char path[64];
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/node%d", cpu, node);
+        if (access(path, F_OK) == 0) {
+            return node;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Get a task ready to run on the c_exec thread, whether it was popped by the scheduler or switched to directly.
+ * @param task The task about to run.
+ */
+void prepare_to_run(struct sut_task *const task) {
+    if (task->action == TASK_IO) {
+        // The task's I/O has completed, so it is no longer outstanding
+        decrement_sem();
+    }
+
+    // A task that returns through uc_link, rather than calling sut_exit, leaves this untouched
+    task->action = TASK_EXIT;
+    task->state = TASK_RUNNING;
+    compute.current = task;
+    stack_set_running(task->step == NULL ? &task->stack : NULL);
+    watchdog_dispatch(task->id, task->entry);
+}
+
+/**
+ * Free a task that has finished running. Called on the c_exec scheduler's stack, never the task's own.
+ * @param task The task to free.
+ */
+void free_task(struct sut_task *const task) {
+    if (task->locals != NULL) {
+        const int keys = __atomic_load_n(&key_count, __ATOMIC_ACQUIRE);
+        for (int key = 0; key < keys; key++) {
+            if (task->locals[key] != NULL && key_destructors[key] != NULL) {
+                key_destructors[key](task->locals[key]);
+            }
+        }
+        free(task->locals);
+    }
+    arena_release(&task->arena);
+
+    struct sut_group *const group = task->group;
+    if (group != NULL) {
+        if (__atomic_sub_fetch(&group->live, 1, __ATOMIC_ACQ_REL) == 0) {
+            // A waiter may have been woken already, and is then left to find the group empty by itself
+            while (group->waiters != NULL) {
+                struct group_waiter *const waiter = group->waiters;
+                group->waiters = waiter->next;
+                waiter->queued = false;
+                sut_unpark(waiter->task);
+            }
+        }
+        if (__atomic_sub_fetch(&group->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+            free(group);
+        }
+    }
+
+    if (task->step == NULL && task->stack.top != NULL) {
+        compute.live_stacks--;
+        const size_t used = stack_used(&task->stack);
+        compute.stack_stats.tasks++;
+        compute.stack_stats.total_used += used;
+        if (used > compute.stack_stats.max_used) {
+            compute.stack_stats.max_used = used;
+        }
+        stack_free(&task->stack);
+    }
+    free(task);
+}
+
+/**
+ * Give a stackful task its stack and context the first time it is dispatched, so that tasks created in a burst only
+ * cost memory once they actually run.
+ * @param task The task about to run.
+ * @return false if no stack could be allocated.
+ */
+bool start_task(struct sut_task *const task) {
+    if (task->step != NULL || task->stack.top != NULL) {
+        return true;
+    }
+    if (!stack_alloc(&task->stack)) {
+        // A failed allocation may have left part of the stack filled in, and a set top means started
+        task->stack = (struct stack) {NULL, NULL, NULL};
+        return false;
+    }
+    task->context = (ucontext_t *) (task->stack.top - CONTEXT_SPACE);
+    if (getcontext(task->context) < 0) {
+        stack_free(&task->stack);
+        task->stack = (struct stack) {NULL, NULL, NULL};
+        return false;
+    }
+
+    task->context->uc_stack.ss_sp = task->stack.low;
+    task->context->uc_stack.ss_size = task->stack.top - CONTEXT_SPACE - task->stack.low;
+    task->context->uc_stack.ss_flags = 0;
+    task->context->uc_link = &compute.context;
+    makecontext(task->context, (sut_task_f) task->entry, 0);
+    compute.live_stacks++;
+    return true;
+}
+
+/**
+ * Run one step of a stackless task on the c_exec thread's own stack.
+ * @param task The stackless task to run.
+ * @return What the step asked the scheduler to do next.
+ */
+enum task_action run_step(struct sut_task *const task) {
+    switch (task->step(task->step_state)) {
+        case SUT_STEP_YIELD:
+            return TASK_YIELD;
+        case SUT_STEP_OFFLOAD:
+            return TASK_IO;
+        case SUT_STEP_PARK:
+            return TASK_PARK;
+        default:
+            return TASK_EXIT;
+    }
+}
+
+/**
+ * Start an executor thread, pinned to a CPU if one was asked for.
+ * @param thread Where to store the thread.
+ * @param cpu The CPU to pin to, or SUT_CPU_ANY.
+ * @param start The thread's entry point.
+ */
+void start_executor(pthread_t *const thread, const int cpu, void *(*start)(void *)) {
+    pthread_attr_t thread_attr;
+    pthread_attr_init(&thread_attr);
+    if (cpu != SUT_CPU_ANY) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        pthread_attr_setaffinity_np(&thread_attr, sizeof(set), &set);
+    }
+    if (pthread_create(thread, &thread_attr, start, NULL) != 0 && cpu != SUT_CPU_ANY) {
+        // The CPU isn't usable (offline or outside our cpuset), so run unpinned rather than not at all
+        pthread_create(thread, NULL, start, NULL);
+    }
+    pthread_attr_destroy(&thread_attr);
+}
+
+/**
+ * Wake the tasks waiting on mailboxes that have been posted to since the last call. The whole list is taken with one
+ * exchange, so unlike a lock-free pop this can't be confused by a mailbox being pushed again meanwhile.
+ */
+void take_posted() {
+    if (__atomic_load_n(&compute.posted, __ATOMIC_RELAXED) == NULL) {
+        return;
+    }
+    struct sut_mailbox *mailbox = __atomic_exchange_n(&compute.posted, NULL, __ATOMIC_ACQUIRE);
+    while (mailbox != NULL) {
+        // Once queued is cleared, a post can push the mailbox again and overwrite its link
+        struct sut_mailbox *const next = mailbox->next_posted;
+        __atomic_store_n(&mailbox->queued, false, __ATOMIC_RELEASE);
+        if (mailbox->waiter != NULL) {
+            sut_unpark(mailbox->waiter);
+        }
+        mailbox = next;
+    }
+}
+
+/**
+ * Move every task in the exec queue to the end of the scheduler's private batch, with one lock acquisition.
+ */
+void take_exec_queue() {
+    pthread_mutex_lock(&compute.lock);
+    queue_concat(&compute.batch, &compute.queue);
+    const size_t queued = compute.queued;
+    compute.queued = 0;
+    pthread_mutex_unlock(&compute.lock);
+
+    if (queued > compute.exec_stats.max_queued) {
+        compute.exec_stats.max_queued = queued;
+    }
+}
+
+/**
+ * Run the next runnable task until it gives the c_exec thread back, then act on what it asked for.
+ * Tasks are taken from the exec queue a whole batch at a time, so the lock is taken once per batch, not per task.
+ * @return false if there was no task to run.
+ */
+bool c_exec_step() {
+    if (queue_peek_front(&compute.batch) == NULL) {
+        take_posted();
+        take_exec_queue();
+    }
+    struct queue_entry *const pop = queue_pop_head(&compute.batch);
+    if (pop == NULL) {
+        return false;
+    }
+    compute.exec_stats.steps++;
+
+    struct sut_task *const next = (struct sut_task *) pop->data;
+    if (!start_task(next)) {
+        // Stacks come back as tasks exit, so wait for one while any is live; otherwise the task can never run
+        if (compute.live_stacks > 0) {
+            insert_node_in_exec_queue(&next->node);
+        } else {
+            fprintf(stderr, "sut: no stack for task %lu, dropping it\n", next->id);
+            free_task(next);
+        }
+        return true;
+    }
+    prepare_to_run(next);
+    if (compute.current->step != NULL) {
+        compute.current->action = run_step(compute.current);
+    } else {
+        swapcontext(&compute.context, compute.current->context);
+    }
+
+    // Tasks can hand off to each other directly, so the one coming back may not be the one dispatched
+    struct sut_task *const task = compute.current;
+    compute.current = NULL;
+    stack_set_running(NULL);
+    watchdog_idle();
+
+    switch (task->action) {
+        case TASK_YIELD:
+            insert_node_in_exec_queue(&task->node);
+            break;
+        case TASK_IO:
+            task->state = TASK_WAITING_IO;
+            submit_io_request(task->request);
+            break;
+        case TASK_PARK:
+            task->state = TASK_PARKED;
+            break;
+        case TASK_EXIT:
+            free_task(task);
+            break;
+    }
+    return true;
+}
+
+/**
+ * Sleep for some time while an executor has nothing to do, counting it as idle.
+ * @param stats The executor's stats.
+ * @param wake_fd An eventfd that ends the sleep early when written, or -1.
+ */
+void idle_wait(struct sut_exec_stats *const stats, const int wake_fd) {
+    const long start = now_ns();
+    struct pollfd wake = {wake_fd, POLLIN, 0};
+    ppoll(&wake, wake_fd >= 0, (const struct timespec[]) {{0, 100000L}}, NULL);
+    if (wake.revents & POLLIN) {
+        eventfd_t count;
+        eventfd_read(wake_fd, &count);
+    }
+    stats->idle_ns += now_ns() - start;
+}
 
 void *c_exec_execute(__attribute__((unused)) void *arg) {
+    stack_thread_init();
+    const long started = now_ns();
     bool start = true;
     while (true) {
-        pthread_mutex_lock(&exec_lock);
-        const struct queue_entry *const pop = queue_pop_head(&exec_queue);
-        pthread_mutex_unlock(&exec_lock);
-        if (pop == NULL) {
-            // start, is_doing_work and sem are all used to see if there is no more work left.
-            if (!is_doing_work && !start && sem == 0) {
+        if (c_exec_step()) {
+            start = false;
+        } else {
+            // start, is_doing_work, sem and mailbox_waiters are all used to see if there is no more work left.
+            if (!io.is_doing_work && !start && compute.sem == 0 && compute.mailbox_waiters == 0) {
+                compute.exec_stats.busy_ns = now_ns() - started - compute.exec_stats.idle_ns;
                 return NULL;
             }
-            // Sleep for some time
-            nanosleep((const struct timespec[]) {{0, 100000L}}, NULL);
-        } else {
-            start = false;
-            const ucontext_t *const ucontext = (ucontext_t *) (pop->data);
-            swapcontext(c_exec_context, ucontext);
+            idle_wait(&compute.exec_stats, compute.wake_fd);
+        }
+    }
+}
+
+/**
+ * Post the result of a request by making its task runnable again.
+ * @param request The finished request.
+ * @param result What the request's function returned.
+ */
+void complete_io_request(struct io_request *const request, const long result) {
+    request->result = result;
+    insert_node_in_exec_queue(&request->task->node);
+}
+
+/**
+ * Check if a request is an fsync or fdatasync, which can be merged with others on the same descriptor.
+ * Invalid descriptors all share one flow, so syncs on them are left to fail one by one.
+ */
+bool is_sync_request(const struct io_request *const request) {
+    return request->fd >= 0 && (request->fn == io_fsync || request->fn == io_fdatasync);
+}
+
+/**
+ * Find the flow for a descriptor in a priority class, creating it if this is its first request.
+ * @return The flow, or NULL if out of memory.
+ */
+struct io_flow *get_io_flow(const enum sut_io_priority priority, const int fd) {
+    // Requests without a descriptor share the first flow
+    const int index = fd < 0 ? 0 : fd + 1;
+    if (index >= io.flow_capacity[priority]) {
+        const int capacity = index < 16 ? 32 : index * 2;
+        struct io_flow **const flows = (struct io_flow **) realloc(io.flows[priority], capacity * sizeof(void *));
+        if (flows == NULL) {
+            return NULL;
+        }
+        for (int i = io.flow_capacity[priority]; i < capacity; i++) {
+            flows[i] = NULL;
+        }
+        io.flows[priority] = flows;
+        io.flow_capacity[priority] = capacity;
+    }
+
+    struct io_flow *flow = io.flows[priority][index];
+    if (flow == NULL) {
+        flow = (struct io_flow *) malloc(sizeof(struct io_flow));
+        if (flow == NULL) {
+            return NULL;
         }
+        queue_init(&flow->requests);
+        flow->deficit = 0;
+        flow->active = false;
+        flow->node.data = flow;
+        io.flows[priority][index] = flow;
+    }
+    return flow;
+}
+
+/**
+ * Queue a submitted request on its flow, and put the flow in its class's round-robin if it was idle.
+ * @param request The request to schedule.
+ */
+void schedule_io_request(struct io_request *const request) {
+    struct io_flow *const flow = get_io_flow(request->priority, request->fd);
+    if (flow == NULL) {
+        complete_io_request(request, -ENOMEM);
+        return;
+    }
+    queue_insert_tail(&flow->requests, &request->node);
+    io.scheduled++;
+    if (!flow->active) {
+        flow->active = true;
+        flow->deficit = 0;
+        queue_insert_tail(&io.active_flows[request->priority], &flow->node);
+    }
+}
+
+/**
+ * Pick the next request to run. Classes are served in strict priority order, so interactive requests never wait
+ * behind bulk ones, and flows within a class share it by deficit round-robin on bytes transferred.
+ * @return The request, or NULL if none are scheduled.
+ */
+struct io_request *next_io_request() {
+    for (int priority = 0; priority < SUT_IO_CLASSES; priority++) {
+        struct queue *const active = &io.active_flows[priority];
+        struct queue_entry *head;
+        while ((head = queue_peek_front(active)) != NULL) {
+            struct io_flow *const flow = (struct io_flow *) head->data;
+            struct queue_entry *const first = queue_peek_front(&flow->requests);
+            if (first == NULL) {
+                // Emptied by a group commit
+                queue_pop_head(active);
+                flow->active = false;
+                continue;
+            }
+
+            struct io_request *const request = (struct io_request *) first->data;
+            if (flow->deficit < request->cost) {
+                // Out of credit for this round, so move on to the next flow
+                flow->deficit += IO_QUANTUM;
+                queue_pop_head(active);
+                queue_insert_tail(active, &flow->node);
+                continue;
+            }
+
+            flow->deficit -= request->cost;
+            queue_pop_head(&flow->requests);
+            if (queue_peek_front(&flow->requests) == NULL) {
+                queue_pop_head(active);
+                flow->active = false;
+            }
+            io.scheduled--;
+            return request;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Group commit: pull every scheduled sync request for the same descriptor, in any class, and complete all of them
+ * from a single sync. Syncs that arrive while it runs queue up and form the next batch.
+ * Each task waits for its own writes before it asks for a sync, so the one sync covers all of them. It is an
+ * fdatasync unless any of the batch asked for a full fsync, so no request gets a weaker guarantee than it asked for.
+ * @param first The sync request that was picked to run.
+ */
+void run_sync_batch(struct io_request *const first) {
+    struct queue batch = queue_create();
+    queue_init(&batch);
+    bool full = first->fn == io_fsync;
+
+    const int index = first->fd + 1;
+    for (int priority = 0; priority < SUT_IO_CLASSES; priority++) {
+        if (index >= io.flow_capacity[priority] || io.flows[priority][index] == NULL) {
+            continue;
+        }
+        struct queue *const requests = &io.flows[priority][index]->requests;
+        struct queue rest = queue_create();
+        queue_init(&rest);
+        struct queue_entry *entry;
+        while ((entry = queue_pop_head(requests)) != NULL) {
+            struct io_request *const request = (struct io_request *) entry->data;
+            if (is_sync_request(request)) {
+                full = full || request->fn == io_fsync;
+                queue_insert_tail(&batch, entry);
+                io.scheduled--;
+            } else {
+                queue_insert_tail(&rest, entry);
+            }
+        }
+        while ((entry = queue_pop_head(&rest)) != NULL) {
+            queue_insert_tail(requests, entry);
+        }
+    }
+
+    const long result = full ? io_fsync(first->arg) : io_fdatasync(first->arg);
+    complete_io_request(first, result);
+    struct queue_entry *entry;
+    while ((entry = queue_pop_head(&batch)) != NULL) {
+        complete_io_request((struct io_request *) entry->data, result);
+    }
+}
+
+/**
+ * Take everything submitted so far, then run the request the fair scheduler picks.
+ * @return false if there was no request to run.
+ */
+bool i_exec_step() {
+    struct queue submitted = queue_create();
+    queue_init(&submitted);
+    pthread_mutex_lock(&io.lock);
+    queue_concat(&submitted, &io.queue);
+    pthread_mutex_unlock(&io.lock);
+
+    // Sorting requests into their flows happens outside the lock, so submitters never wait on it
+    struct queue_entry *pop;
+    while ((pop = queue_pop_head(&submitted)) != NULL) {
+        schedule_io_request((struct io_request *) pop->data);
+    }
+    if ((size_t) io.scheduled > io.exec_stats.max_queued) {
+        io.exec_stats.max_queued = io.scheduled;
+    }
+
+    struct io_request *const request = next_io_request();
+    if (request == NULL) {
+        return false;
+    }
+    io.exec_stats.steps++;
+
+    // Run the request on this thread's own stack, then post the completion by making the task runnable
+    if (is_sync_request(request)) {
+        run_sync_batch(request);
+    } else {
+        complete_io_request(request, request->fn(request->arg));
+    }
+    return true;
+}
+
+/**
+ * Set up the fair scheduler's state, which belongs to whichever thread runs the I/O steps.
+ */
+void init_io_flows() {
+    for (int priority = 0; priority < SUT_IO_CLASSES; priority++) {
+        io.flows[priority] = NULL;
+        io.flow_capacity[priority] = 0;
+        queue_init(&io.active_flows[priority]);
+    }
+    io.scheduled = 0;
+}
+
+void free_io_flows() {
+    for (int priority = 0; priority < SUT_IO_CLASSES; priority++) {
+        for (int i = 0; i < io.flow_capacity[priority]; i++) {
+            free(io.flows[priority][i]);
+        }
+        free(io.flows[priority]);
+        io.flows[priority] = NULL;
+        io.flow_capacity[priority] = 0;
     }
 }
 
 void *i_exec_execute(__attribute__((unused)) void *arg) {
+    init_io_flows();
+    const long started = now_ns();
+
     // Run until c_exec thread stops running
-    while (c_exec) {
-        pthread_mutex_lock(&io_lock);
-        const struct queue_entry *const pop = queue_pop_head(&io_queue);
-        pthread_mutex_unlock(&io_lock);
-        if (pop == NULL) {
-            is_doing_work = false;
-            // Sleep for some time
-            nanosleep((const struct timespec[]) {{0, 100000L}}, NULL);
+    while (compute.thread) {
+        // Only write the flag when it changes, since the c_exec thread reads its cache line
+        if (i_exec_step()) {
+            if (!io.is_doing_work) {
+                io.is_doing_work = true;
+            }
         } else {
-            is_doing_work = true;
-            const ucontext_t *const ucontext = (ucontext_t *) (pop->data);
-            swapcontext(i_exec_context, ucontext);
+            if (io.is_doing_work) {
+                io.is_doing_work = false;
+            }
+            idle_wait(&io.exec_stats, -1);
         }
     }
+
+    io.exec_stats.busy_ns = now_ns() - started - io.exec_stats.idle_ns;
+    free_io_flows();
     return NULL;
 }
 
+/**
+ * Run both executors' steps on the calling thread, in an order picked by the seeded (or replayed) schedule, until
+ * neither has anything left to do. Without threads or sleeps, every run with the same seed is the same run.
+ */
+void run_deterministic() {
+    stack_thread_init();
+    init_io_flows();
+    sim_start(attr.sim_seed, attr.sim_io_latency, attr.sim_record, attr.sim_replay);
+    while (true) {
+        take_posted();
+        pthread_mutex_lock(&io.lock);
+        const bool submitted = queue_peek_front(&io.queue) != NULL;
+        pthread_mutex_unlock(&io.lock);
+        pthread_mutex_lock(&compute.lock);
+        const bool can_compute = queue_peek_front(&compute.batch) != NULL || queue_peek_front(&compute.queue) != NULL;
+        pthread_mutex_unlock(&compute.lock);
+        const bool can_io = submitted || io.scheduled > 0;
+        if (!can_compute && !can_io) {
+            break;
+        }
+
+        if (sim_choose_io(can_compute, can_io)) {
+            i_exec_step();
+        } else {
+            c_exec_step();
+        }
+    }
+    sim_stop();
+    free_io_flows();
+}
+
+void sut_attr_init(struct sut_attr *const a) {
+    a->c_exec_cpu = SUT_CPU_ANY;
+    a->i_exec_cpu = SUT_CPU_ANY;
+    a->stack_node = SUT_NODE_LOCAL;
+    a->stack_size = STACK_SIZE;
+    a->stack_initial = 0;
+    a->stack_canary = false;
+    a->stack_huge_pages = false;
+    a->watchdog_ms = 0;
+    a->inline_io = true;
+    a->io_buf_count = 0;
+    a->io_buf_size = IO_BUF_SIZE;
+    a->deterministic = false;
+    a->sim_seed = 1;
+    a->sim_io_latency = 4;
+    a->sim_record = NULL;
+    a->sim_replay = NULL;
+}
+
 void sut_init() {
+    struct sut_attr defaults;
+    sut_attr_init(&defaults);
+    sut_init_attr(&defaults);
+}
+
+void sut_init_attr(const struct sut_attr *const a) {
+    attr = *a;
+    // Inline I/O would bypass the simulated I/O executor, and with it the interleavings being explored
+    if (attr.deterministic) {
+        attr.inline_io = false;
+    }
+    struct stack_config stack_config = {attr.stack_size, attr.stack_initial, attr.stack_canary, attr.stack_node,
+                                        attr.stack_huge_pages};
+    // A local stack node follows the c_exec thread when it is pinned, and is left to first touch otherwise
+    if (stack_config.node == SUT_NODE_LOCAL && attr.c_exec_cpu != SUT_CPU_ANY) {
+        stack_config.node = cpu_to_node(attr.c_exec_cpu);
+    }
+    stack_configure(&stack_config);
+    // Without the pool, sut_buf_get just returns NULL, as it does when every buffer is borrowed
+    if (!iobuf_init(attr.io_buf_count, attr.io_buf_size)) {
+        fprintf(stderr, "sut: can't map %zu I/O buffers of %zu bytes, running without the pool\n", attr.io_buf_count,
+                attr.io_buf_size);
+    }
+
     // Initialise semaphore like variable to 0
-    sem = 0;
-    is_doing_work = true;
-    pthread_mutex_init(&sem_lock, PTHREAD_MUTEX_DEFAULT);
-    pthread_mutex_init(&exec_lock, PTHREAD_MUTEX_DEFAULT);
-    pthread_mutex_init(&io_lock, PTHREAD_MUTEX_DEFAULT);
+    compute.sem = 0;
+    compute.mailbox_waiters = 0;
+    compute.live_stacks = 0;
+    compute.posted = NULL;
+    // Stats cover one init/shutdown run; busy_ns in particular is worked out from this run's idle_ns alone
+    memset(&compute.exec_stats, 0, sizeof(compute.exec_stats));
+    memset(&io.exec_stats, 0, sizeof(io.exec_stats));
+    memset(&compute.stack_stats, 0, sizeof(compute.stack_stats));
+    memset(&compute.io_stats, 0, sizeof(compute.io_stats));
+    compute.wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    io.is_doing_work = true;
+    pthread_mutex_init(&compute.lock, PTHREAD_MUTEX_DEFAULT);
+    pthread_mutex_init(&io.lock, PTHREAD_MUTEX_DEFAULT);
 
-    exec_queue = queue_create();
-    queue_init(&exec_queue);
-    io_queue = queue_create();
-    queue_init(&io_queue);
+    compute.queue = queue_create();
+    queue_init(&compute.queue);
+    queue_init(&compute.batch);
+    io.queue = queue_create();
+    queue_init(&io.queue);
 
-    c_exec_context = (ucontext_t *) malloc(sizeof(ucontext_t));
-    i_exec_context = (ucontext_t *) malloc(sizeof(ucontext_t));
+    if (attr.deterministic) {
+        // Nothing runs until sut_shutdown drives both executors from the calling thread
+        compute.thread = NULL;
+        io.thread = NULL;
+        return;
+    }
 
-    c_exec = (pthread_t *) malloc(sizeof(pthread_t));
-    i_exec = (pthread_t *) malloc(sizeof(pthread_t));
+    compute.thread = (pthread_t *) malloc(sizeof(pthread_t));
+    io.thread = (pthread_t *) malloc(sizeof(pthread_t));
 
-    pthread_create(c_exec, NULL, c_exec_execute, NULL);
-    pthread_create(i_exec, NULL, i_exec_execute, NULL);
+    start_executor(compute.thread, attr.c_exec_cpu, c_exec_execute);
+    start_executor(io.thread, attr.i_exec_cpu, i_exec_execute);
+    watchdog_start(*compute.thread, attr.watchdog_ms);
 }
 
 /**
- * Insert a node into the exec queue.
- * @param node The queue_entry to insert.
+ * Create a task and add it to the exec queue.
+ * @param fn The task's entry point.
+ * @param group The group the task belongs to, or NULL. Set before the task is queued, so it can't run without it.
+ * @return The task, or NULL if it could not be created.
  */
-void insert_node_in_exec_queue(struct queue_entry *const node) {
-    pthread_mutex_lock(&exec_lock);
-    queue_insert_tail(&exec_queue, node);
-    pthread_mutex_unlock(&exec_lock);
+struct sut_task *spawn(sut_task_f fn, struct sut_group *const group) {
+    struct sut_task *const task = (struct sut_task *) malloc(sizeof(struct sut_task));
+    if (task == NULL) {
+        return NULL;
+    }
+
+    // The stack and context are only set up by start_task, when the task is first dispatched
+    task->stack = (struct stack) {NULL, NULL, NULL};
+    task->action = TASK_EXIT;
+    task->state = TASK_READY;
+    task->request = NULL;
+    task->step = NULL;
+    task->step_state = NULL;
+    task->locals = NULL;
+    task->arena = NULL;
+    task->group = group;
+    task->io_priority = SUT_IO_NORMAL;
+    task->id = __atomic_add_fetch(&task_count, 1, __ATOMIC_RELAXED);
+    task->entry = (void *) fn;
+    task->node.data = task;
+    if (group != NULL) {
+        __atomic_add_fetch(&group->refs, 1, __ATOMIC_ACQ_REL);
+        __atomic_add_fetch(&group->live, 1, __ATOMIC_ACQ_REL);
+    }
+    insert_node_in_exec_queue(&task->node);
+
+    return task;
 }
 
-/**
- * Add a context to the exec queue.
- * @param ucontext The context to add to the queue.
- * @return true if successfully added to queue, false otherwise
- */
-bool add_context_to_queue(ucontext_t *const ucontext) {
-    struct queue_entry *const node = queue_new_node(ucontext);
-    if (node == NULL) {
-        return false;
+struct sut_task *sut_spawn(sut_task_f fn) {
+    return spawn(fn, NULL);
+}
+
+struct sut_task *sut_create_stackless(sut_step_f step, void *state) {
+    struct sut_task *const task = (struct sut_task *) malloc(sizeof(struct sut_task));
+    if (task == NULL) {
+        return NULL;
     }
 
-    insert_node_in_exec_queue(node);
+    task->action = TASK_EXIT;
+    task->state = TASK_READY;
+    task->request = NULL;
+    task->stack = (struct stack) {NULL, NULL, NULL};
+    task->step = step;
+    task->step_state = state;
+    task->locals = NULL;
+    task->arena = NULL;
+    task->group = NULL;
+    task->io_priority = SUT_IO_NORMAL;
+    task->id = __atomic_add_fetch(&task_count, 1, __ATOMIC_RELAXED);
+    task->entry = (void *) step;
+    task->step_io.request.result = 0;
+    task->node.data = task;
+    insert_node_in_exec_queue(&task->node);
 
-    return true;
+    return task;
 }
 
 bool sut_create(sut_task_f fn) {
-    ucontext_t *const ucontext = (ucontext_t *) malloc(sizeof(ucontext_t));
-    if (ucontext == NULL) {
+    return sut_spawn(fn) != NULL;
+}
+
+struct sut_task *sut_self() {
+    return compute.current;
+}
+
+size_t sut_stack_used() {
+    return compute.current->step == NULL ? stack_used(&compute.current->stack) : 0;
+}
+
+void sut_stack_stats(struct sut_stack_stats *const stats) {
+    *stats = compute.stack_stats;
+}
+
+void sut_io_stats(struct sut_io_stats *const stats) {
+    *stats = compute.io_stats;
+}
+
+void sut_exec_stats(struct sut_exec_stats *const compute_stats, struct sut_exec_stats *const io_stats) {
+    *compute_stats = compute.exec_stats;
+    *io_stats = io.exec_stats;
+}
+
+int sut_key_create(sut_key_t *const key, void (*destructor)(void *)) {
+    const int k = __atomic_fetch_add(&key_count, 1, __ATOMIC_ACQ_REL);
+    if (k >= SUT_KEYS_MAX) {
+        __atomic_fetch_sub(&key_count, 1, __ATOMIC_ACQ_REL);
+        return -EAGAIN;
+    }
+    key_destructors[k] = destructor;
+    *key = (sut_key_t) k;
+    return 0;
+}
+
+void *sut_getspecific(const sut_key_t key) {
+    void **const locals = compute.current->locals;
+    return locals == NULL || key >= SUT_KEYS_MAX ? NULL : locals[key];
+}
+
+int sut_setspecific(const sut_key_t key, void *const value) {
+    struct sut_task *const task = compute.current;
+    if (key >= SUT_KEYS_MAX) {
+        return -EINVAL;
+    }
+    if (task->locals == NULL) {
+        // Allocated on first use, so tasks that never set a value don't pay for the slots
+        task->locals = (void **) calloc(SUT_KEYS_MAX, sizeof(void *));
+        if (task->locals == NULL) {
+            return -ENOMEM;
+        }
+    }
+    task->locals[key] = value;
+    return 0;
+}
+
+void *sut_alloc(const size_t size) {
+    return arena_alloc(&compute.current->arena, size);
+}
+
+void *sut_buf_get() {
+    return iobuf_get();
+}
+
+bool sut_buf_put(void *const buf) {
+    return iobuf_put(buf);
+}
+
+size_t sut_buf_size() {
+    return iobuf_size();
+}
+
+struct sut_group *sut_group_create() {
+    struct sut_group *const group = (struct sut_group *) malloc(sizeof(struct sut_group));
+    if (group != NULL) {
+        group->live = 0;
+        group->refs = 1;
+        group->cancelled = false;
+        group->waiters = NULL;
+    }
+    return group;
+}
+
+struct sut_task *sut_group_spawn(struct sut_group *const group, sut_task_f fn) {
+    return spawn(fn, group);
+}
+
+int sut_group_wait(struct sut_group *const group) {
+    // The last member to exit unparks this task, but so can sut_unpark or sut_switch_to, so check again
+    struct group_waiter self = {compute.current, NULL, false};
+    while (__atomic_load_n(&group->live, __ATOMIC_ACQUIRE) > 0) {
+        if (!self.queued) {
+            self.next = group->waiters;
+            group->waiters = &self;
+            self.queued = true;
+        }
+        sut_park();
+    }
+    return group->cancelled ? -ECANCELED : 0;
+}
+
+void sut_group_cancel(struct sut_group *const group) {
+    group->cancelled = true;
+}
+
+void sut_group_destroy(struct sut_group *const group) {
+    if (__atomic_sub_fetch(&group->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        free(group);
+    }
+}
+
+bool sut_cancelled() {
+    const struct sut_group *const group = compute.current->group;
+    return group != NULL && group->cancelled;
+}
+
+void sut_yield() {
+    struct sut_task *const task = compute.current;
+    // Yielding is a cancellation point, both before giving up the c_exec thread and after getting it back
+    if (sut_cancelled()) {
+        sut_exit();
+    }
+    task->action = TASK_YIELD;
+    swapcontext(task->context, &compute.context);
+    if (sut_cancelled()) {
+        sut_exit();
+    }
+}
+
+void sut_park() {
+    struct sut_task *const task = compute.current;
+    task->action = TASK_PARK;
+    swapcontext(task->context, &compute.context);
+}
+
+struct sut_mailbox *sut_mailbox_create() {
+    struct sut_mailbox *const mailbox = (struct sut_mailbox *) malloc(sizeof(struct sut_mailbox));
+    if (mailbox != NULL) {
+        *mailbox = (struct sut_mailbox) {0, false, NULL, NULL};
+    }
+    return mailbox;
+}
+
+void sut_post(struct sut_mailbox *const mailbox, const unsigned long value) {
+    __atomic_add_fetch(&mailbox->value, value, __ATOMIC_RELEASE);
+    // Only the post that queues the mailbox wakes anything; the rest of a burst rides along with it
+    if (__atomic_exchange_n(&mailbox->queued, true, __ATOMIC_ACQ_REL)) {
+        return;
+    }
+    struct sut_mailbox *head = __atomic_load_n(&compute.posted, __ATOMIC_RELAXED);
+    do {
+        mailbox->next_posted = head;
+    } while (!__atomic_compare_exchange_n(&compute.posted, &head, mailbox, true, __ATOMIC_RELEASE,
+                                          __ATOMIC_RELAXED));
+    eventfd_write(compute.wake_fd, 1);
+}
+
+unsigned long sut_mailbox_wait(struct sut_mailbox *const mailbox) {
+    unsigned long value;
+    while ((value = __atomic_exchange_n(&mailbox->value, 0, __ATOMIC_ACQUIRE)) == 0) {
+        // A post landing before the park is only drained by the scheduler after the task has parked
+        mailbox->waiter = compute.current;
+        compute.mailbox_waiters++;
+        sut_park();
+        compute.mailbox_waiters--;
+        mailbox->waiter = NULL;
+    }
+    return value;
+}
+
+void sut_mailbox_destroy(struct sut_mailbox *const mailbox) {
+    // It may still be on the posted list, which must not be left pointing at freed memory
+    take_posted();
+    free(mailbox);
+}
+
+bool sut_unpark(struct sut_task *const task) {
+    if (task->state != TASK_PARKED) {
+        return false;
+    }
+    insert_node_in_exec_queue(&task->node);
+    return true;
+}
+
+/**
+ * Switch the c_exec thread straight from the current task to target, without going through the scheduler.
+ * @param target The task to run next. It must be parked, or waiting in the exec queue.
+ * @param requeue Whether the current task goes to the back of the exec queue, or is left parked.
+ * @return false if target can't be switched to, in which case the current task keeps running.
+ */
+bool switch_to(struct sut_task *const target, const bool requeue) {
+    struct sut_task *const self = compute.current;
+    if (target == self) {
         return false;
     }
 
-    if (getcontext(ucontext) < 0) {
+    if (target->step != NULL) {
+        // A stackless task has no context to switch to; it only runs from the scheduler
         return false;
     }
 
-    // Create space for the stack
-    char *const uc_s = (char *) malloc(sizeof(char) * (STACK_SIZE));
-    if (uc_s == NULL) {
+    // The i_exec thread makes tasks ready under the exec queue lock, so the state is read under it too
+    pthread_mutex_lock(&compute.lock);
+    const enum task_state state = target->state;
+    pthread_mutex_unlock(&compute.lock);
+
+    if (state == TASK_READY) {
+        if (!start_task(target)) {
+            return false;
+        }
+        // A ready task may be in the exec queue or already in the scheduler's batch, so gather them in one place
+        take_exec_queue();
+        if (!queue_remove(&compute.batch, &target->node)) {
+            return false;
+        }
+    } else if (state != TASK_PARKED) {
         return false;
     }
 
-    ucontext->uc_stack.ss_sp = uc_s;
-    ucontext->uc_stack.ss_size = sizeof(char) * (STACK_SIZE);
-    ucontext->uc_stack.ss_flags = 0;
-    ucontext->uc_link = c_exec_context;
-    makecontext(ucontext, fn, 0);
+    // With a single c_exec thread, nothing can pop this task before its context is saved below
+    if (requeue) {
+        insert_node_in_exec_queue(&self->node);
+    } else {
+        self->state = TASK_PARKED;
+    }
+
+    prepare_to_run(target);
+    swapcontext(self->context, target->context);
+    return true;
+}
 
-    return add_context_to_queue(ucontext);
+bool sut_switch_to(struct sut_task *target) {
+    return switch_to(target, true);
 }
 
-void sut_yield() {
-    ucontext_t *const ucontext = (ucontext_t *) malloc(sizeof(ucontext_t));
-    add_context_to_queue(ucontext);
-    swapcontext(ucontext, c_exec_context);
+bool sut_park_and_switch_to(struct sut_task *target) {
+    return switch_to(target, false);
 }
 
 void sut_exit() {
-    setcontext(c_exec_context);
+    // The scheduler frees the task once it is off the task's stack
+    compute.current->action = TASK_EXIT;
+    setcontext(&compute.context);
 }
 
 /**
- * Make an empty context, add it to a node and add it to the back of the io queue.
- * @return The node with the empty context as its data
+ * Run fn(arg) on the i_exec thread and wait for its result.
+ * @param fd The descriptor the request works on, or -1, which decides the flow it is fairly scheduled in.
+ * @param cost What the request costs against its flow's deficit.
  */
-struct queue_entry *make_empty_context_and_add_to_io() {
-    // Increment the semaphore
-    pthread_mutex_lock(&sem_lock);
-    sem++;
-    pthread_mutex_unlock(&sem_lock);
+long offload(sut_offload_f fn, void *arg, const int fd, const int cost) {
+    struct sut_task *const task = compute.current;
+    // Don't start I/O for a cancelled task; I/O that was already in flight still reports its result
+    if (sut_cancelled()) {
+        return -ECANCELED;
+    }
+
+    struct io_request request = {
+            .fn = fn, .arg = arg, .result = 0, .task = task, .fd = fd, .cost = cost, .priority = task->io_priority
+    };
+    request.node.data = &request;
 
-    ucontext_t *const ucontext = (ucontext_t *) malloc(sizeof(ucontext_t));
+    // Park the task; the c_exec scheduler submits the request once the context is saved
+    task->action = TASK_IO;
+    task->request = &request;
+    swapcontext(task->context, &compute.context);
 
-    struct queue_entry *const node = queue_new_node(ucontext);
+    // The i_exec thread filled in the result before making this task runnable again
+    task->request = NULL;
+    return request.result;
+}
 
-    pthread_mutex_lock(&io_lock);
-    queue_insert_tail(&io_queue, node);
-    pthread_mutex_unlock(&io_lock);
+long sut_offload(sut_offload_f fn, void *arg) {
+    return offload(fn, arg, -1, IO_OP_COST);
+}
 
-    return node;
+void sut_set_io_priority(const enum sut_io_priority priority) {
+    compute.current->io_priority = priority;
 }
 
 /**
- * Decrement the semaphore.
+ * Open the file named by arg with the flags SUT has always used.
+ * @return The file descriptor, or a negative errno value.
  */
-void decrement_sem() {
-    pthread_mutex_lock(&sem_lock);
-    sem--;
-    pthread_mutex_unlock(&sem_lock);
+static long io_open(void *arg) {
+    const int fd = open((const char *) arg, O_RDWR | O_CREAT | O_APPEND, 0600);
+    return fd < 0 ? -errno : fd;
 }
 
-int sut_open(char *file_name) {
-    struct queue_entry *const node = make_empty_context_and_add_to_io();
-    ucontext_t *const ucontext = (ucontext_t *) node->data;
+static long io_open_ex(void *arg) {
+    const struct open_args *const args = (struct open_args *) arg;
+    const int fd = open(args->file_name, args->flags, args->mode);
+    return fd < 0 ? -errno : fd;
+}
+
+static long io_close(void *arg) {
+    return close((int) (intptr_t) arg) < 0 ? -errno : 0;
+}
 
-    // Save the context at this point, and go back to the c_exec scheduler
-    swapcontext(ucontext, c_exec_context);
+static long io_read(void *arg) {
+    const struct io_args *const args = (struct io_args *) arg;
+    const ssize_t n = read(args->fd, args->buf, args->size);
+    return n < 0 ? -errno : n;
+}
+
+static long io_write(void *arg) {
+    const struct io_args *const args = (struct io_args *) arg;
+    const ssize_t n = write(args->fd, args->buf, args->size);
+    return n < 0 ? -errno : n;
+}
+
+static long io_pread(void *arg) {
+    const struct io_args *const args = (struct io_args *) arg;
+    const ssize_t n = pread(args->fd, args->buf, args->size, args->offset);
+    return n < 0 ? -errno : n;
+}
+
+static long io_pwrite(void *arg) {
+    const struct io_args *const args = (struct io_args *) arg;
+    const ssize_t n = pwrite(args->fd, args->buf, args->size, args->offset);
+    return n < 0 ? -errno : n;
+}
+
+static long io_fsync(void *arg) {
+    return fsync((int) (intptr_t) arg) < 0 ? -errno : 0;
+}
+
+static long io_fdatasync(void *arg) {
+    return fdatasync((int) (intptr_t) arg) < 0 ? -errno : 0;
+}
+
+static long io_stat(void *arg) {
+    const struct stat_args *const args = (struct stat_args *) arg;
+    return stat(args->file_name, args->st) < 0 ? -errno : 0;
+}
+
+/**
+ * Read until the buffer is full or end of file is reached, retrying on short reads and EINTR.
+ * @return The number of bytes read, or a negative errno value if nothing could be read.
+ */
+static long io_read_exact(void *arg) {
+    const struct io_args *const args = (struct io_args *) arg;
+    int total = 0;
+    while (total < args->size) {
+        const ssize_t n = read(args->fd, args->buf + total, args->size - total);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return total > 0 ? total : -errno;
+        }
+        if (n == 0) {
+            break;
+        }
+        total += (int) n;
+    }
+    return total;
+}
 
-    const int result = open(file_name, O_RDWR | O_CREAT | O_APPEND, 0600);
+/**
+ * Write the whole buffer, retrying on short writes and EINTR.
+ * @return The number of bytes written, or a negative errno value if nothing could be written.
+ */
+static long io_write_all(void *arg) {
+    const struct io_args *const args = (struct io_args *) arg;
+    int total = 0;
+    while (total < args->size) {
+        const ssize_t n = write(args->fd, args->buf + total, args->size - total);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return total > 0 ? total : -errno;
+        }
+        total += (int) n;
+    }
+    return total;
+}
 
-    // Insert the node into the exec queue once the io thread has produced a result
-    insert_node_in_exec_queue(node);
+/**
+ * Record whether the kernel supports RWF_NOWAIT for a kind of transfer on a descriptor.
+ * @param fd The descriptor.
+ * @param kind NOWAIT_READ, NOWAIT_WRITE, or both.
+ * @param supported Whether it does; a descriptor that was just opened or closed is assumed to.
+ */
+void set_nowait_supported(const int fd, const unsigned char kind, const bool supported) {
+    if (fd < 0) {
+        return;
+    }
+    if (fd >= compute.nowait_capacity) {
+        if (supported) {
+            return;
+        }
+        const int capacity = fd < 32 ? 64 : fd * 2;
+        unsigned char *const flags = (unsigned char *) realloc(compute.nowait_unsupported, capacity);
+        if (flags == NULL) {
+            return;
+        }
+        memset(flags + compute.nowait_capacity, 0, capacity - compute.nowait_capacity);
+        compute.nowait_unsupported = flags;
+        compute.nowait_capacity = capacity;
+    }
+    if (supported) {
+        compute.nowait_unsupported[fd] &= (unsigned char) ~kind;
+    } else {
+        compute.nowait_unsupported[fd] |= kind;
+    }
+}
 
-    // Save the context at this point, and go back to the i_exec scheduler
-    swapcontext(ucontext, i_exec_context);
+/**
+ * Try a read or write on the c_exec thread with RWF_NOWAIT, which fails with EAGAIN rather than block, so that
+ * transfers served by the page cache skip the round trip through the i_exec thread.
+ * @param kind NOWAIT_READ or NOWAIT_WRITE.
+ * @param args The transfer.
+ * @param positional Whether this is sut_pread or sut_pwrite, rather than a transfer at the file position.
+ * @param result Set to the byte count or negative errno if the transfer was done here.
+ * @return true if it was done here, false if it has to be offloaded.
+ */
+bool try_inline_io(const unsigned char kind, const struct io_args *const args, const bool positional,
+                   long *const result) {
+    const off_t offset = positional ? args->offset : -1;
+    // A negative descriptor is offloaded, so it fails with -EBADF the same way as without inline I/O, and so is a
+    // negative offset on positional I/O, which preadv2 would take as the file position rather than fail with -EINVAL
+    if (!attr.inline_io || args->fd < 0 || (positional && offset < 0) ||
+        (args->fd < compute.nowait_capacity && compute.nowait_unsupported[args->fd] & kind)) {
+        compute.io_stats.offloaded++;
+        return false;
+    }
 
-    decrement_sem();
+    const struct iovec iov = {args->buf, (size_t) args->size};
+    const ssize_t n = kind == NOWAIT_READ ? preadv2(args->fd, &iov, 1, offset, RWF_NOWAIT)
+                                          : pwritev2(args->fd, &iov, 1, offset, RWF_NOWAIT);
+    if (n >= 0) {
+        compute.io_stats.inline_hits++;
+        *result = n;
+        return true;
+    }
 
-    // Return the result via the c_exec thread
-    return result;
+    if (errno == EOPNOTSUPP) {
+        // This kind of file, or this kernel, can't do it without blocking, so stop asking
+        set_nowait_supported(args->fd, kind, false);
+    } else if (errno != EAGAIN && errno != EINTR && errno != EINVAL) {
+        // A real error, which the i_exec thread would only run into again
+        compute.io_stats.inline_hits++;
+        *result = -errno;
+        return true;
+    }
+    // EINVAL may be down to this transfer's arguments rather than the descriptor, so only this one is offloaded
+    compute.io_stats.inline_misses++;
+    return false;
 }
 
-void sut_write(int fd, char *buf, int size) {
-    struct queue_entry *const node = make_empty_context_and_add_to_io();
-    ucontext_t *const ucontext = (ucontext_t *) node->data;
+int sut_open(char *file_name) {
+    const int fd = (int) offload(io_open, file_name, -1, IO_OP_COST);
+    set_nowait_supported(fd, NOWAIT_READ | NOWAIT_WRITE, true);
+    return fd;
+}
 
-    // Save the context at this point, and go back to the c_exec scheduler
-    swapcontext(ucontext, c_exec_context);
+int sut_write(int fd, char *buf, int size) {
+    struct io_args args = {fd, buf, size, 0};
+    long result;
+    if (!sut_cancelled() && try_inline_io(NOWAIT_WRITE, &args, false, &result)) {
+        return (int) result;
+    }
+    return (int) offload(io_write, &args, fd, IO_OP_COST + size);
+}
 
-    write(fd, buf, size);
+int sut_write_all(int fd, char *buf, int size) {
+    // Retry on the i_exec thread, so that short writes don't cost extra trips through the c_exec scheduler
+    struct io_args args = {fd, buf, size, 0};
+    return (int) offload(io_write_all, &args, fd, IO_OP_COST + size);
+}
 
-    // Insert the node into the exec queue once the io thread has produced a result
-    insert_node_in_exec_queue(node);
+int sut_close(int fd) {
+    set_nowait_supported(fd, NOWAIT_READ | NOWAIT_WRITE, true);
+    return (int) offload(io_close, (void *) (intptr_t) fd, fd, IO_OP_COST);
+}
 
-    // Save the context at this point, and go back to the i_exec scheduler
-    swapcontext(ucontext, i_exec_context);
+int sut_read(int fd, char *buf, int size) {
+    struct io_args args = {fd, buf, size, 0};
+    long result;
+    if (!sut_cancelled() && try_inline_io(NOWAIT_READ, &args, false, &result)) {
+        return (int) result;
+    }
+    return (int) offload(io_read, &args, fd, IO_OP_COST + size);
+}
 
-    decrement_sem();
+int sut_read_exact(int fd, char *buf, int size) {
+    // Retry on the i_exec thread, so that short reads don't cost extra trips through the c_exec scheduler
+    struct io_args args = {fd, buf, size, 0};
+    return (int) offload(io_read_exact, &args, fd, IO_OP_COST + size);
 }
 
-void sut_close(int fd) {
-    struct queue_entry *const node = make_empty_context_and_add_to_io();
-    ucontext_t *const ucontext = (ucontext_t *) node->data;
+int sut_open_ex(const char *file_name, int flags, mode_t mode) {
+    struct open_args args = {file_name, flags, mode};
+    const int fd = (int) offload(io_open_ex, &args, -1, IO_OP_COST);
+    // RWF_NOWAIT doesn't stop an O_DIRECT transfer from waiting on the device, so those are always offloaded
+    set_nowait_supported(fd, NOWAIT_READ | NOWAIT_WRITE, (flags & O_DIRECT) == 0);
+    return fd;
+}
 
-    // Save the context at this point, and go back to the c_exec scheduler
-    swapcontext(ucontext, c_exec_context);
+int sut_pread(int fd, char *buf, int size, off_t offset) {
+    struct io_args args = {fd, buf, size, offset};
+    long result;
+    if (!sut_cancelled() && try_inline_io(NOWAIT_READ, &args, true, &result)) {
+        return (int) result;
+    }
+    return (int) offload(io_pread, &args, fd, IO_OP_COST + size);
+}
 
-    close(fd);
+int sut_pwrite(int fd, char *buf, int size, off_t offset) {
+    struct io_args args = {fd, buf, size, offset};
+    long result;
+    if (!sut_cancelled() && try_inline_io(NOWAIT_WRITE, &args, true, &result)) {
+        return (int) result;
+    }
+    return (int) offload(io_pwrite, &args, fd, IO_OP_COST + size);
+}
 
-    // Insert the node into the exec queue once the io thread has produced a result
-    insert_node_in_exec_queue(node);
+int sut_fsync(int fd) {
+    return (int) offload(io_fsync, (void *) (intptr_t) fd, fd, IO_OP_COST);
+}
 
-    // Save the context at this point, and go back to the i_exec scheduler
-    swapcontext(ucontext, i_exec_context);
+int sut_fdatasync(int fd) {
+    return (int) offload(io_fdatasync, (void *) (intptr_t) fd, fd, IO_OP_COST);
+}
 
-    decrement_sem();
+int sut_stat(const char *file_name, struct stat *st) {
+    struct stat_args args = {file_name, st};
+    return (int) offload(io_stat, &args, -1, IO_OP_COST);
 }
 
-char *sut_read(int fd, char *buf, int size) {
-    struct queue_entry *const node = make_empty_context_and_add_to_io();
-    ucontext_t *const ucontext = (ucontext_t *) node->data;
+/**
+ * Fill in a stackless task's request, for the scheduler to submit once the step returns.
+ * @param fd The descriptor the request works on, or -1, which decides the flow it is fairly scheduled in.
+ * @param cost What the request costs against its flow's deficit.
+ */
+enum sut_step step_offload(sut_offload_f fn, void *arg, const int fd, const int cost) {
+    struct sut_task *const task = compute.current;
+    struct io_request *const request = &task->step_io.request;
+    request->fn = fn;
+    request->arg = arg;
+    request->task = task;
+    request->fd = fd;
+    request->cost = cost;
+    request->priority = task->io_priority;
+    request->node.data = request;
+    task->request = request;
+    return SUT_STEP_OFFLOAD;
+}
 
-    // Save the context at this point, and go back to the c_exec scheduler
-    swapcontext(ucontext, c_exec_context);
+enum sut_step sut_step_offload(sut_offload_f fn, void *arg) {
+    return step_offload(fn, arg, -1, IO_OP_COST);
+}
 
-    char *const result = read(fd, buf, size) < 0 ? NULL : buf;
+long sut_step_result() {
+    return compute.current->step_io.request.result;
+}
 
-    // Insert the node into the exec queue once the io thread has produced a result
-    insert_node_in_exec_queue(node);
+enum sut_step sut_step_open(char *file_name) {
+    return step_offload(io_open, file_name, -1, IO_OP_COST);
+}
 
-    // Save the context at this point, and go back to the i_exec scheduler
-    swapcontext(ucontext, i_exec_context);
+enum sut_step sut_step_write(int fd, char *buf, int size) {
+    struct io_args *const args = &compute.current->step_io.args;
+    *args = (struct io_args) {fd, buf, size, 0};
+    return step_offload(io_write, args, fd, IO_OP_COST + size);
+}
 
-    decrement_sem();
+enum sut_step sut_step_close(int fd) {
+    return step_offload(io_close, (void *) (intptr_t) fd, fd, IO_OP_COST);
+}
 
-    // Return the result via the c_exec thread
-    return result;
+enum sut_step sut_step_read(int fd, char *buf, int size) {
+    struct io_args *const args = &compute.current->step_io.args;
+    *args = (struct io_args) {fd, buf, size, 0};
+    return step_offload(io_read, args, fd, IO_OP_COST + size);
 }
 
 void sut_shutdown() {
-    pthread_join(*c_exec, NULL);
-    free(c_exec);
-    c_exec = NULL;
-    pthread_join(*i_exec, NULL);
-    free(i_exec);
-    free(c_exec_context);
-    free(i_exec_context);
-}
\ No newline at end of file
+    if (attr.deterministic) {
+        run_deterministic();
+    } else {
+        pthread_join(*compute.thread, NULL);
+        watchdog_stop();
+        free(compute.thread);
+        compute.thread = NULL;
+        pthread_join(*io.thread, NULL);
+        free(io.thread);
+    }
+    free(compute.nowait_unsupported);
+    compute.nowait_unsupported = NULL;
+    compute.nowait_capacity = 0;
+    iobuf_destroy();
+    arena_shutdown();
+    stack_shutdown();
+    close(compute.wake_fd);
+}
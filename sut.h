@@ -1,18 +1,214 @@
 #ifndef __SUT_H__
 #define __SUT_H__
 #include <stdbool.h>
+#include <stddef.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
 
 typedef void (*sut_task_f)();
+typedef long (*sut_offload_f)(void *arg);
+
+/**
+ * What a stackless task's step function asks the scheduler to do once it returns.
+ */
+enum sut_step {
+    SUT_STEP_EXIT,
+    SUT_STEP_YIELD,
+    SUT_STEP_PARK,
+    SUT_STEP_OFFLOAD,
+};
+
+typedef enum sut_step (*sut_step_f)(void *state);
+
+/**
+ * I/O priority classes. A class is only served when all higher ones have nothing queued; within a class,
+ * descriptors share the I/O executor fairly by bytes transferred.
+ */
+enum sut_io_priority {
+    SUT_IO_INTERACTIVE,
+    SUT_IO_NORMAL,
+    SUT_IO_BULK,
+    SUT_IO_CLASSES,
+};
+
+typedef unsigned int sut_key_t;
+
+#define SUT_KEYS_MAX 32
+#define SUT_CPU_ANY (-1)
+#define SUT_NODE_LOCAL (-1)
 
+/**
+ * Runtime options, filled with defaults by sut_attr_init and passed to sut_init_attr.
+ */
+struct sut_attr {
+    // CPUs to pin the compute and I/O executor threads to, or SUT_CPU_ANY
+    int c_exec_cpu;
+    int i_exec_cpu;
+    // NUMA node task stacks are preferably allocated on; SUT_NODE_LOCAL uses the node of c_exec_cpu
+    int stack_node;
+    // Usable bytes per task stack, below which sits a guard page that catches overflows
+    size_t stack_size;
+    // Bytes of stack a task starts with; smaller than stack_size makes stacks grow on demand, 0 maps all of it
+    size_t stack_initial;
+    // Fill stacks with a canary, so usage is measured to the byte rather than the page, at the cost of touching it all
+    bool stack_canary;
+    // Carve stacks out of 2 MiB transparent huge pages, which cuts TLB misses when switching between tasks.
+    // Stacks are rounded up to a huge page, mapped in full rather than grown, and kept for reuse after a task exits.
+    // Every running task then commits a whole 2 MiB however little of it it touches, so RSS grows by about
+    // 2 MiB / (bytes touched per task) over normal stacks: 256 tasks touching 16 KiB each take 545 MiB instead of
+    // 6.6 MiB. Only worth it for a few hundred tasks with deep stacks, not for large task counts.
+    bool stack_huge_pages;
+    // Report a task that holds the compute executor for longer than this, with a backtrace; 0 disables the watchdog
+    unsigned int watchdog_ms;
+    // Try reads and writes on the compute executor with RWF_NOWAIT first, and only offload those that would block.
+    // Reads served from the page cache benefit. Buffered writes mostly don't: ext4 and most other filesystems refuse
+    // RWF_NOWAIT for them, so after the first attempt writes to such a file are always offloaded. So is all I/O on
+    // descriptors opened with O_DIRECT, which RWF_NOWAIT doesn't keep from waiting on the device. Always off in
+    // deterministic simulation.
+    bool inline_io;
+    // A pool of io_buf_count buffers of io_buf_size bytes, mapped up front and aligned for O_DIRECT, that tasks borrow
+    // with sut_buf_get. 0 buffers means no pool.
+    size_t io_buf_count;
+    size_t io_buf_size;
+    // Deterministic simulation: no executor threads are started, and sut_shutdown runs compute and I/O steps on the
+    // calling thread in an order picked from sim_seed. sim_io_latency is the mean number of compute steps taken per
+    // I/O step while both have work. The schedule can be recorded to, or replayed from, a file.
+    bool deterministic;
+    unsigned long sim_seed;
+    unsigned int sim_io_latency;
+    const char *sim_record;
+    const char *sim_replay;
+};
+
+/**
+ * Stack high-water marks of the stackful tasks that have exited so far.
+ */
+struct sut_stack_stats {
+    size_t tasks;
+    size_t max_used;
+    size_t total_used;
+};
+
+/**
+ * How reads and writes were served: inline on the compute executor, or offloaded after an inline attempt would have
+ * blocked, or offloaded without one because inline I/O is off or unsupported for the descriptor.
+ */
+struct sut_io_stats {
+    size_t inline_hits;
+    size_t inline_misses;
+    size_t offloaded;
+};
+
+/**
+ * How loaded an executor was: how many steps it ran, the most work it found queued at once, and how long it was
+ * busy versus sleeping for lack of work. Deterministic simulation has no executor threads, so it only counts steps.
+ */
+struct sut_exec_stats {
+    size_t steps;
+    size_t max_queued;
+    unsigned long busy_ns;
+    unsigned long idle_ns;
+};
+
+// A handle to a task. It is only valid until the task exits.
+struct sut_task;
+struct sut_group;
+struct sut_mailbox;
+
+void sut_attr_init(struct sut_attr *attr);
 void sut_init();
+void sut_init_attr(const struct sut_attr *attr);
+// Creating a task only queues it; its stack is allocated, or reused from an exited task, when it first runs.
 bool sut_create(sut_task_f fn);
+struct sut_task *sut_spawn(sut_task_f fn);
+struct sut_task *sut_self();
 void sut_yield();
+// The deepest the current task's stack has been, in bytes, counting its saved context at the top.
+size_t sut_stack_used();
+// Only call from a task or after sut_shutdown, since the stats are updated by the compute executor.
+void sut_stack_stats(struct sut_stack_stats *stats);
+// Same as sut_stack_stats.
+void sut_io_stats(struct sut_io_stats *stats);
+// Only call after sut_shutdown, since each executor updates its own stats.
+void sut_exec_stats(struct sut_exec_stats *compute_stats, struct sut_exec_stats *io_stats);
+// Task-local storage. Keys are shared by all tasks, values belong to the current task, and a key's destructor is
+// called on each task's non-NULL value when that task exits.
+int sut_key_create(sut_key_t *key, void (*destructor)(void *));
+void *sut_getspecific(sut_key_t key);
+int sut_setspecific(sut_key_t key, void *value);
+// Task groups. sut_group_wait parks the calling task until every member has exited, and returns -ECANCELED if the
+// group was cancelled. Cancellation is cooperative: members exit at their next sut_yield, and I/O calls return
+// -ECANCELED instead of starting; sut_cancelled lets long computations poll for it. Any number of tasks can wait on
+// a group. sut_group_destroy may be called while members still run, which keep the group until they exit, but not
+// while a task is still in sut_group_wait on it.
+struct sut_group *sut_group_create();
+struct sut_task *sut_group_spawn(struct sut_group *group, sut_task_f fn);
+int sut_group_wait(struct sut_group *group);
+void sut_group_cancel(struct sut_group *group);
+void sut_group_destroy(struct sut_group *group);
+bool sut_cancelled();
+// Allocate from the current task's arena. There is no matching free: the whole arena goes when the task exits.
+void *sut_alloc(size_t size);
+// Borrow an aligned buffer of sut_buf_size() bytes from the pool, or NULL if none is free. Only call from a task.
+void *sut_buf_get();
+// Return a borrowed buffer. Only call from a task. Returns false if buf isn't from the pool or isn't borrowed.
+bool sut_buf_put(void *buf);
+size_t sut_buf_size();
+// Park the current task until another task calls sut_unpark on it.
+void sut_park();
+bool sut_unpark(struct sut_task *task);
+// Mailboxes let threads outside the runtime, and signal handlers, wake a task. sut_post adds value to the mailbox
+// and never locks or allocates; posts that arrive before the waiter runs are coalesced into one wakeup.
+// sut_mailbox_wait parks the calling task until the mailbox is non-zero, then takes the whole value, like reading an
+// eventfd. A task waiting on a mailbox keeps the runtime running. Only destroy a mailbox from a task or after sut_shutdown,
+// once nothing posts to it any more.
+struct sut_mailbox *sut_mailbox_create();
+void sut_post(struct sut_mailbox *mailbox, unsigned long value);
+unsigned long sut_mailbox_wait(struct sut_mailbox *mailbox);
+void sut_mailbox_destroy(struct sut_mailbox *mailbox);
+// Run target next, in a single context switch. The current task is either requeued or left parked.
+bool sut_switch_to(struct sut_task *target);
+bool sut_park_and_switch_to(struct sut_task *target);
 void sut_exit();
+// The I/O calls return a file descriptor or byte count on success, and a negative errno value on failure.
 int sut_open(char *file_name);
-void sut_write(int fd, char *buf, int size);
-void sut_close(int fd);
-char *sut_read(int fd, char *buf, int size);
+int sut_write(int fd, char *buf, int size);
+int sut_close(int fd);
+int sut_read(int fd, char *buf, int size);
+// Keep transferring until all size bytes are done (or end of file for reads); retries happen on the I/O executor.
+int sut_write_all(int fd, char *buf, int size);
+int sut_read_exact(int fd, char *buf, int size);
+// Open with explicit open(2) flags and mode, where sut_open always uses O_RDWR | O_CREAT | O_APPEND and 0600.
+int sut_open_ex(const char *file_name, int flags, mode_t mode);
+// Positional I/O leaves the file offset alone, so tasks can share one descriptor without serialising on it.
+int sut_pread(int fd, char *buf, int size, off_t offset);
+int sut_pwrite(int fd, char *buf, int size, off_t offset);
+int sut_fsync(int fd);
+int sut_fdatasync(int fd);
+int sut_stat(const char *file_name, struct stat *st);
+// Set the priority class of the current task's I/O from now on. Tasks start as SUT_IO_NORMAL.
+void sut_set_io_priority(enum sut_io_priority priority);
+// Run fn(arg) on the I/O executor, so that blocking calls never stall the compute executor, and return its result.
+long sut_offload(sut_offload_f fn, void *arg);
 void sut_shutdown();
 
+// A stackless task runs step(state) on the executor's own stack each time it is scheduled, until a step returns
+// SUT_STEP_EXIT. It must not call the blocking task API (sut_yield, sut_exit, sut_park or the I/O calls); instead a
+// step returns one of the calls below, and the next step reads the result with sut_step_result.
+struct sut_task *sut_create_stackless(sut_step_f step, void *state);
+enum sut_step sut_step_offload(sut_offload_f fn, void *arg);
+enum sut_step sut_step_open(char *file_name);
+enum sut_step sut_step_write(int fd, char *buf, int size);
+enum sut_step sut_step_close(int fd);
+enum sut_step sut_step_read(int fd, char *buf, int size);
+long sut_step_result();
+
+#ifdef __cplusplus
+}
+#endif
 
 #endif
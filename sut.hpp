@@ -0,0 +1,225 @@
+#ifndef __SUT_HPP__
+#define __SUT_HPP__
+#include <atomic>
+#include <coroutine>
+#include <exception>
+#include <utility>
+#include "sut.h"
+
+/**
+ * C++20 coroutines over the stackless task API. A coroutine returning sut::task runs as a stackless task on the
+ * compute executor once passed to sut::spawn, so its frame replaces a whole task stack, and each co_await on an
+ * awaitable below ends the current step with the matching sut_step_* call.
+ */
+namespace sut {
+
+namespace detail {
+
+/**
+ * What a coroutine and its join_handle share, so that either can go first.
+ */
+struct join_state {
+    std::atomic<int> refs{2};
+    bool done = false;
+    struct sut_task *waiter = nullptr;
+
+    void release() {
+        if (refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            delete this;
+        }
+    }
+};
+
+}
+
+class task {
+public:
+    struct promise_type {
+        // What the step the coroutine last suspended in returns to the scheduler
+        enum sut_step next = SUT_STEP_YIELD;
+        detail::join_state *join = nullptr;
+
+        task get_return_object() {
+            return task(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+        // Nothing runs until the first step, on the compute executor
+        std::suspend_always initial_suspend() noexcept {
+            return {};
+        }
+        // The step that sees the coroutine done destroys it
+        std::suspend_always final_suspend() noexcept {
+            return {};
+        }
+        void return_void() {
+        }
+        void unhandled_exception() {
+            std::terminate();
+        }
+    };
+
+    task(task &&other) noexcept : handle(std::exchange(other.handle, nullptr)) {
+    }
+    task(const task &) = delete;
+    task &operator=(const task &) = delete;
+    // A task that was never spawned never ran, so its frame is still ours to destroy
+    ~task() {
+        if (handle) {
+            handle.destroy();
+        }
+    }
+
+    std::coroutine_handle<promise_type> release() {
+        return std::exchange(handle, nullptr);
+    }
+
+private:
+    explicit task(std::coroutine_handle<promise_type> h) : handle(h) {
+    }
+
+    std::coroutine_handle<promise_type> handle;
+};
+
+namespace detail {
+
+/**
+ * The step function of every coroutine task: run the coroutine to its next suspension point, and tell the scheduler
+ * what it suspended for.
+ */
+inline enum sut_step step(void *state) {
+    const auto h = std::coroutine_handle<task::promise_type>::from_address(state);
+    h.resume();
+    if (!h.done()) {
+        return h.promise().next;
+    }
+
+    join_state *const join = h.promise().join;
+    h.destroy();
+    join->done = true;
+    if (join->waiter != nullptr) {
+        sut_unpark(join->waiter);
+    }
+    join->release();
+    return SUT_STEP_EXIT;
+}
+
+/**
+ * Suspend the coroutine with issue's sut_step_* call as the result of its step, and resume it with the result.
+ */
+template <typename Issue>
+struct step_awaiter {
+    Issue issue;
+
+    bool await_ready() const noexcept {
+        return false;
+    }
+    void await_suspend(std::coroutine_handle<task::promise_type> h) {
+        h.promise().next = issue();
+    }
+    long await_resume() const noexcept {
+        return sut_step_result();
+    }
+};
+
+}
+
+/**
+ * Waits for a spawned coroutine, from another coroutine with co_await join(), or from a stackful task with wait().
+ */
+class join_handle {
+public:
+    explicit join_handle(detail::join_state *s) : state(s) {
+    }
+    join_handle(join_handle &&other) noexcept : state(std::exchange(other.state, nullptr)) {
+    }
+    join_handle(const join_handle &) = delete;
+    join_handle &operator=(const join_handle &) = delete;
+    ~join_handle() {
+        if (state != nullptr) {
+            state->release();
+        }
+    }
+
+    auto join() {
+        struct awaiter {
+            detail::join_state *state;
+
+            bool await_ready() const noexcept {
+                return state == nullptr || state->done;
+            }
+            void await_suspend(std::coroutine_handle<task::promise_type> h) {
+                state->waiter = sut_self();
+                h.promise().next = SUT_STEP_PARK;
+            }
+            void await_resume() const noexcept {
+            }
+        };
+        return awaiter{state};
+    }
+
+    // Only call from a stackful task.
+    void wait() {
+        while (state != nullptr && !state->done) {
+            state->waiter = sut_self();
+            sut_park();
+        }
+    }
+
+private:
+    detail::join_state *state;
+};
+
+/**
+ * Start a coroutine as a stackless task. Like sut_create, this can be called from main or from any task.
+ * @return A handle to wait for it with; if the task couldn't be created, it is already done.
+ */
+inline join_handle spawn(task t) {
+    const auto h = t.release();
+    auto *const state = new detail::join_state;
+    h.promise().join = state;
+    if (sut_create_stackless(detail::step, h.address()) == nullptr) {
+        h.destroy();
+        // Only the handle is left to share it with
+        state->done = true;
+        state->refs.store(1, std::memory_order_relaxed);
+    }
+    return join_handle(state);
+}
+
+inline auto yield() {
+    struct awaiter {
+        bool await_ready() const noexcept {
+            return false;
+        }
+        void await_suspend(std::coroutine_handle<task::promise_type> h) {
+            h.promise().next = SUT_STEP_YIELD;
+        }
+        void await_resume() const noexcept {
+        }
+    };
+    return awaiter{};
+}
+
+// The I/O awaitables resume with what the matching sut_* call returns: a descriptor, a byte count, or -errno.
+inline auto open(char *file_name) {
+    return detail::step_awaiter{[=] { return sut_step_open(file_name); }};
+}
+
+inline auto read(int fd, char *buf, int size) {
+    return detail::step_awaiter{[=] { return sut_step_read(fd, buf, size); }};
+}
+
+inline auto write(int fd, char *buf, int size) {
+    return detail::step_awaiter{[=] { return sut_step_write(fd, buf, size); }};
+}
+
+inline auto close(int fd) {
+    return detail::step_awaiter{[=] { return sut_step_close(fd); }};
+}
+
+inline auto offload(sut_offload_f fn, void *arg) {
+    return detail::step_awaiter{[=] { return sut_step_offload(fn, arg); }};
+}
+
+}
+
+#endif
@@ -0,0 +1,96 @@
+#include <stdalign.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "sut_arena.h"
+
+#define ARENA_CHUNK_SIZE (64*1024)
+#define ARENA_CHUNKS_KEPT 64
+#define ARENA_ALIGN alignof(max_align_t)
+#define ARENA_HEADER ((sizeof(struct arena_chunk) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1))
+
+// Released chunks of the default size, kept for reuse. Arenas are only used by tasks and released by the
+// scheduler, all on the c_exec thread, so this needs no lock.
+struct arena_chunk *free_chunks;
+int free_chunk_count;
+
+/**
+ * Get a chunk able to hold size bytes, reusing a released one when it is big enough.
+ * @return The chunk, or NULL if out of memory.
+ */
+struct arena_chunk *new_chunk(const size_t size) {
+    if (size <= ARENA_CHUNK_SIZE - ARENA_HEADER && free_chunks != NULL) {
+        struct arena_chunk *const chunk = free_chunks;
+        free_chunks = chunk->next;
+        free_chunk_count--;
+        chunk->used = ARENA_HEADER;
+        return chunk;
+    }
+
+    const size_t chunk_size = size + ARENA_HEADER > ARENA_CHUNK_SIZE ? size + ARENA_HEADER : ARENA_CHUNK_SIZE;
+    struct arena_chunk *const chunk = (struct arena_chunk *) malloc(chunk_size);
+    if (chunk == NULL) {
+        return NULL;
+    }
+    chunk->size = chunk_size;
+    chunk->used = ARENA_HEADER;
+    return chunk;
+}
+
+/**
+ * Bump-allocate from an arena, adding a chunk when the newest one is full.
+ * @param arena The arena's newest chunk, or NULL if it has none yet.
+ * @param size The number of bytes wanted.
+ * @return Memory aligned for any type, or NULL if out of memory.
+ */
+void *arena_alloc(struct arena_chunk **const arena, size_t size) {
+    // Neither the rounding below nor adding the chunk header may wrap around
+    if (size > SIZE_MAX - ARENA_HEADER - ARENA_ALIGN) {
+        return NULL;
+    }
+    size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+    struct arena_chunk *chunk = *arena;
+    if (chunk == NULL || chunk->size - chunk->used < size) {
+        chunk = new_chunk(size);
+        if (chunk == NULL) {
+            return NULL;
+        }
+        chunk->next = *arena;
+        *arena = chunk;
+    }
+
+    void *const p = (char *) chunk + chunk->used;
+    chunk->used += size;
+    return p;
+}
+
+/**
+ * Release every chunk of an arena at once, keeping default sized ones for reuse.
+ * @param arena The arena's newest chunk. Left NULL.
+ */
+void arena_release(struct arena_chunk **const arena) {
+    struct arena_chunk *chunk = *arena;
+    while (chunk != NULL) {
+        struct arena_chunk *const next = chunk->next;
+        if (chunk->size == ARENA_CHUNK_SIZE && free_chunk_count < ARENA_CHUNKS_KEPT) {
+            chunk->next = free_chunks;
+            free_chunks = chunk;
+            free_chunk_count++;
+        } else {
+            free(chunk);
+        }
+        chunk = next;
+    }
+    *arena = NULL;
+}
+
+/**
+ * Free the chunks kept for reuse, once no task is left to use them.
+ */
+void arena_shutdown() {
+    while (free_chunks != NULL) {
+        struct arena_chunk *const next = free_chunks->next;
+        free(free_chunks);
+        free_chunks = next;
+    }
+    free_chunk_count = 0;
+}
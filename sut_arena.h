@@ -0,0 +1,18 @@
+#ifndef __SUT_ARENA_H__
+#define __SUT_ARENA_H__
+#include <stddef.h>
+
+/**
+ * One block of a task's bump arena. Chunks are chained newest first, and allocations are carved from the newest.
+ */
+struct arena_chunk {
+    struct arena_chunk *next;
+    size_t size;
+    size_t used;
+};
+
+void *arena_alloc(struct arena_chunk **arena, size_t size);
+void arena_release(struct arena_chunk **arena);
+void arena_shutdown();
+
+#endif
@@ -0,0 +1,108 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include "sut_iobuf.h"
+
+// Buffers are aligned to, and sized in multiples of, this, which satisfies O_DIRECT on any common block device
+#define IOBUF_ALIGN 4096
+
+// The pool is one mapping carved into equal buffers, with the free ones linked through their first word.
+// Buffers are borrowed and returned by tasks, all on the c_exec thread, so this needs no lock.
+char *pool;
+size_t pool_count;
+size_t buf_size;
+void *free_bufs;
+// One bit per buffer, set while it is borrowed, so that a buffer returned twice isn't linked in twice
+unsigned char *borrowed;
+
+/**
+ * Map and pre-fault the pool, so that borrowing a buffer never allocates or faults.
+ * @param count How many buffers to make, or 0 for no pool.
+ * @param size Bytes per buffer, rounded up to the alignment.
+ * @return false if the pool is too large or could not be mapped.
+ */
+bool iobuf_init(const size_t count, const size_t size) {
+    pool_count = 0;
+    free_bufs = NULL;
+    if (size > SIZE_MAX - (IOBUF_ALIGN - 1)) {
+        buf_size = 0;
+        return false;
+    }
+    buf_size = (size + IOBUF_ALIGN - 1) & ~((size_t) IOBUF_ALIGN - 1);
+    if (count == 0 || buf_size == 0) {
+        return true;
+    }
+    if (count > SIZE_MAX / buf_size) {
+        return false;
+    }
+
+    borrowed = (unsigned char *) calloc((count + 7) / 8, 1);
+    if (borrowed == NULL) {
+        return false;
+    }
+    void *const mapping = mmap(NULL, count * buf_size, PROT_READ | PROT_WRITE,
+                               MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    if (mapping == MAP_FAILED) {
+        free(borrowed);
+        borrowed = NULL;
+        return false;
+    }
+    pool = (char *) mapping;
+    pool_count = count;
+    // Link them lowest first, so the first borrowed is at the start of the pool
+    for (size_t i = count; i > 0; i--) {
+        void *const buf = pool + (i - 1) * buf_size;
+        *(void **) buf = free_bufs;
+        free_bufs = buf;
+    }
+    return true;
+}
+
+/**
+ * Borrow a buffer from the pool.
+ * @return The buffer, or NULL if all of them are borrowed.
+ */
+void *iobuf_get() {
+    void *const buf = free_bufs;
+    if (buf != NULL) {
+        free_bufs = *(void **) buf;
+        const size_t i = (size_t) ((char *) buf - pool) / buf_size;
+        borrowed[i / 8] |= (unsigned char) (1 << i % 8);
+    }
+    return buf;
+}
+
+/**
+ * Return a borrowed buffer to the pool.
+ * @param buf The buffer, as returned by iobuf_get.
+ * @return false if buf is not a buffer of the pool, or is not borrowed.
+ */
+bool iobuf_put(void *const buf) {
+    const char *const p = (const char *) buf;
+    if (pool_count == 0 || p < pool || p >= pool + pool_count * buf_size || (size_t) (p - pool) % buf_size != 0) {
+        return false;
+    }
+    const size_t i = (size_t) (p - pool) / buf_size;
+    if (!(borrowed[i / 8] & 1 << i % 8)) {
+        return false;
+    }
+    borrowed[i / 8] &= (unsigned char) ~(1 << i % 8);
+    *(void **) buf = free_bufs;
+    free_bufs = buf;
+    return true;
+}
+
+size_t iobuf_size() {
+    return buf_size;
+}
+
+void iobuf_destroy() {
+    if (pool_count > 0) {
+        munmap(pool, pool_count * buf_size);
+    }
+    free(borrowed);
+    borrowed = NULL;
+    pool = NULL;
+    pool_count = 0;
+    free_bufs = NULL;
+}
@@ -0,0 +1,12 @@
+#ifndef __SUT_IOBUF_H__
+#define __SUT_IOBUF_H__
+#include <stdbool.h>
+#include <stddef.h>
+
+bool iobuf_init(size_t count, size_t size);
+void *iobuf_get();
+bool iobuf_put(void *buf);
+size_t iobuf_size();
+void iobuf_destroy();
+
+#endif
@@ -0,0 +1,78 @@
+#include <stdio.h>
+#include "sut_sim.h"
+
+#define SCHEDULE_COMPUTE 'c'
+#define SCHEDULE_IO 'i'
+
+unsigned long rng_state;
+unsigned int mean_io_latency;
+FILE *record_file, *replay_file;
+unsigned long steps;
+
+/**
+ * xorshift64*, which is small and plenty for picking interleavings.
+ * @return The next pseudo-random number.
+ */
+unsigned long next_random() {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545f4914f6cdd1dUL;
+}
+
+/**
+ * Start a deterministic run.
+ * @param seed Seeds the choice of which executor steps next.
+ * @param io_latency The mean number of compute steps per I/O step when both have work, which simulates slow I/O.
+ * @param record_path If not NULL, every choice is written here, one character per step.
+ * @param replay_path If not NULL, choices are read from here instead of being made by the seeded generator.
+ */
+void sim_start(const unsigned long seed, const unsigned int io_latency, const char *const record_path,
+               const char *const replay_path) {
+    // xorshift never leaves an all-zero state
+    rng_state = seed == 0 ? 1 : seed;
+    mean_io_latency = io_latency;
+    steps = 0;
+    record_file = record_path != NULL ? fopen(record_path, "w") : NULL;
+    replay_file = replay_path != NULL ? fopen(replay_path, "r") : NULL;
+    if (replay_path != NULL && replay_file == NULL) {
+        fprintf(stderr, "sut: can't open schedule %s, using seed %lu instead\n", replay_path, seed);
+    }
+}
+
+/**
+ * Decide which executor takes the next step. At least one of them must have work.
+ * @return true for the I/O executor, false for the compute executor.
+ */
+bool sim_choose_io(const bool can_compute, const bool can_io) {
+    bool io;
+    const int replayed = replay_file != NULL ? fgetc(replay_file) : EOF;
+    if (replayed == SCHEDULE_COMPUTE || replayed == SCHEDULE_IO) {
+        io = replayed == SCHEDULE_IO;
+        if (io ? !can_io : !can_compute) {
+            fprintf(stderr, "sut: schedule diverged from the recording at step %lu\n", steps);
+            io = !io;
+        }
+    } else if (can_compute && can_io) {
+        io = next_random() % (mean_io_latency + 1) == 0;
+    } else {
+        io = can_io;
+    }
+
+    if (record_file != NULL) {
+        fputc(io ? SCHEDULE_IO : SCHEDULE_COMPUTE, record_file);
+    }
+    steps++;
+    return io;
+}
+
+void sim_stop() {
+    if (record_file != NULL) {
+        fclose(record_file);
+        record_file = NULL;
+    }
+    if (replay_file != NULL) {
+        fclose(replay_file);
+        replay_file = NULL;
+    }
+}
@@ -0,0 +1,9 @@
+#ifndef __SUT_SIM_H__
+#define __SUT_SIM_H__
+#include <stdbool.h>
+
+void sim_start(unsigned long seed, unsigned int io_latency, const char *record_path, const char *replay_path);
+bool sim_choose_io(bool can_compute, bool can_io);
+void sim_stop();
+
+#endif
@@ -0,0 +1,305 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/mempolicy.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "sut_stack.h"
+
+#define STACK_CANARY ((char) 0xa5)
+#define SIGNAL_STACK_SIZE (64*1024)
+#define HUGE_PAGE_SIZE (2*1024*1024)
+#define HUGE_CHUNK_SIZE (64*1024*1024)
+#define STACKS_KEPT 64
+
+struct stack_config config;
+size_t page_size;
+bool growable;
+// The stack of the task running on this thread, looked at by the fault handler
+__thread struct stack *running_stack;
+/**
+ * A mapping that huge page stacks are carved from, remembered so it can be unmapped at shutdown.
+ */
+struct huge_chunk {
+    struct huge_chunk *next;
+    char *base;
+    size_t length;
+};
+
+// Stacks are only allocated when a task is first dispatched and freed when it exits, both on the c_exec thread, so
+// the stacks kept for reuse need no lock. Huge page stacks are all kept, linked through the word at the top of each.
+char *huge_free_list;
+struct huge_chunk *huge_chunks;
+struct stack kept[STACKS_KEPT];
+int kept_count;
+
+/**
+ * Grow the running task's stack when it faults just below its accessible region. Any other fault, including one
+ * in the guard page, restores the default action so that it is raised again as a normal crash.
+ */
+void on_stack_fault(__attribute__((unused)) int sig, siginfo_t *info, __attribute__((unused)) void *context) {
+    struct stack *const stack = running_stack;
+    char *const addr = (char *) info->si_addr;
+    if (stack != NULL && addr >= stack->base + page_size && addr < stack->low) {
+        // At least double the accessible region, so a deep call chain takes few faults
+        char *const floor = stack->base + page_size;
+        const size_t accessible = stack->top - stack->low;
+        char *low = (size_t) (stack->low - floor) > accessible ? stack->low - accessible : floor;
+        const uintptr_t fault_page = (uintptr_t) addr & ~(page_size - 1);
+        if ((char *) fault_page < low) {
+            low = (char *) fault_page;
+        }
+        if (mprotect(low, stack->low - low, PROT_READ | PROT_WRITE) == 0) {
+            if (config.canary) {
+                memset(low, STACK_CANARY, stack->low - low);
+            }
+            stack->low = low;
+            return;
+        }
+    }
+
+    if (stack != NULL && addr >= stack->base && addr < stack->base + page_size) {
+        static const char message[] = "sut: task stack overflow\n";
+        write(STDERR_FILENO, message, sizeof(message) - 1);
+    }
+    signal(SIGSEGV, SIG_DFL);
+}
+
+/**
+ * Unmap the stacks kept for reuse, once no task is left to use them.
+ */
+void stack_shutdown() {
+    while (kept_count > 0) {
+        struct stack *const stack = &kept[--kept_count];
+        munmap(stack->base, stack->top - stack->base);
+    }
+    // Huge page stacks are sized by the configuration they were mapped under, so none may outlive it
+    while (huge_chunks != NULL) {
+        struct huge_chunk *const next = huge_chunks->next;
+        munmap(huge_chunks->base, huge_chunks->length);
+        free(huge_chunks);
+        huge_chunks = next;
+    }
+    huge_free_list = NULL;
+}
+
+void stack_configure(const struct stack_config *const c) {
+    // Kept stacks are the size of the last configuration
+    stack_shutdown();
+    config = *c;
+    page_size = (size_t) sysconf(_SC_PAGESIZE);
+    config.size = (config.size + page_size - 1) & ~(page_size - 1);
+    config.initial = (config.initial + page_size - 1) & ~(page_size - 1);
+    if (config.huge_pages) {
+        // Growing a stack a page at a time would split its huge pages, so huge page stacks are mapped in full
+        config.size = (config.size + HUGE_PAGE_SIZE - 1) & ~((size_t) HUGE_PAGE_SIZE - 1);
+        config.initial = 0;
+    }
+    growable = config.initial != 0 && config.initial < config.size;
+
+    if (growable) {
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_sigaction = on_stack_fault;
+        action.sa_flags = SA_SIGINFO | SA_ONSTACK;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGSEGV, &action, NULL);
+    }
+}
+
+/**
+ * Give the calling executor thread an alternate signal stack, since a stack fault can't be handled on the stack
+ * that faulted.
+ */
+void stack_thread_init() {
+    if (!growable) {
+        return;
+    }
+    stack_t signal_stack;
+    signal_stack.ss_sp = malloc(SIGNAL_STACK_SIZE);
+    signal_stack.ss_size = SIGNAL_STACK_SIZE;
+    signal_stack.ss_flags = 0;
+    if (signal_stack.ss_sp != NULL) {
+        sigaltstack(&signal_stack, NULL);
+    }
+}
+
+/**
+ * Prefer a NUMA node for a range of stack memory, if one is configured.
+ */
+void bind_to_node(void *const addr, const size_t length) {
+    if (config.node >= 0) {
+        unsigned long mask[16] = {0};
+        const unsigned long bits = sizeof(unsigned long) * 8;
+        mask[config.node / bits] = 1UL << (config.node % bits);
+        // Only a preference, so a full node falls back to another one rather than failing the task
+        syscall(SYS_mbind, addr, length, MPOL_PREFERRED, mask, sizeof(mask) * 8, 0);
+    }
+}
+
+/**
+ * Map a chunk of huge page stacks and add them to the free list. Each stack is huge page aligned and sits above a
+ * guard of a whole huge page, which costs address space but no memory, so that the guard doesn't split the huge
+ * pages of the stacks around it.
+ * @return false if the chunk could not be mapped.
+ */
+bool map_huge_chunk() {
+    const size_t slot = HUGE_PAGE_SIZE + config.size;
+    const size_t slots = HUGE_CHUNK_SIZE / slot > 0 ? HUGE_CHUNK_SIZE / slot : 1;
+    const size_t length = slots * slot;
+    // Over-allocate by a huge page so the chunk can be trimmed to an aligned start
+    char *const mapping = (char *) mmap(NULL, length + HUGE_PAGE_SIZE, PROT_NONE,
+                                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK | MAP_NORESERVE, -1, 0);
+    if (mapping == MAP_FAILED) {
+        return false;
+    }
+    char *const chunk = (char *) (((uintptr_t) mapping + HUGE_PAGE_SIZE - 1) & ~((uintptr_t) HUGE_PAGE_SIZE - 1));
+    if (chunk > mapping) {
+        munmap(mapping, chunk - mapping);
+    }
+    munmap(chunk + length, mapping + HUGE_PAGE_SIZE - chunk);
+    struct huge_chunk *const record = (struct huge_chunk *) malloc(sizeof(struct huge_chunk));
+    if (record == NULL) {
+        munmap(chunk, length);
+        return false;
+    }
+    *record = (struct huge_chunk) {huge_chunks, chunk, length};
+    huge_chunks = record;
+
+    for (size_t i = 0; i < slots; i++) {
+        char *const low = chunk + i * slot + HUGE_PAGE_SIZE;
+        if (mprotect(low, config.size, PROT_READ | PROT_WRITE) != 0) {
+            // The stacks already added stay usable; the rest of the chunk is never handed out
+            return i > 0;
+        }
+        madvise(low, config.size, MADV_HUGEPAGE);
+        char *const top = low + config.size;
+        *(char **) (top - sizeof(char *)) = huge_free_list;
+        huge_free_list = top;
+    }
+    bind_to_node(chunk, length);
+    return true;
+}
+
+/**
+ * Take a stack from the huge page free list, mapping a new chunk when it is empty.
+ * @return false if no stack could be mapped.
+ */
+bool huge_stack_alloc(struct stack *const stack) {
+    if (huge_free_list == NULL && !map_huge_chunk()) {
+        return false;
+    }
+    char *const top = huge_free_list;
+    huge_free_list = *(char **) (top - sizeof(char *));
+
+    stack->top = top;
+    stack->low = top - config.size;
+    stack->base = stack->low - HUGE_PAGE_SIZE;
+    if (config.canary) {
+        // A recycled stack still holds what the last task left on it
+        memset(stack->low, STACK_CANARY, stack->top - stack->low);
+    }
+    return true;
+}
+
+/**
+ * Map a stack with a guard page below it. With a node set, its pages are preferably placed on that node; otherwise
+ * they land wherever the first touch happens, which is the c_exec thread once the task runs.
+ * @return false if the stack could not be mapped.
+ */
+bool stack_alloc(struct stack *const stack) {
+    if (config.huge_pages) {
+        return huge_stack_alloc(stack);
+    }
+    if (kept_count > 0) {
+        *stack = kept[--kept_count];
+        if (config.canary) {
+            memset(stack->low, STACK_CANARY, stack->top - stack->low);
+        }
+        return true;
+    }
+
+    const size_t length = config.size + page_size;
+    void *const base = mmap(NULL, length, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED) {
+        return false;
+    }
+
+    stack->base = (char *) base;
+    stack->top = stack->base + length;
+    stack->low = growable ? stack->top - config.initial : stack->base + page_size;
+    if (mprotect(stack->low, stack->top - stack->low, PROT_READ | PROT_WRITE) != 0) {
+        munmap(base, length);
+        return false;
+    }
+
+    bind_to_node(base, length);
+
+    if (config.canary) {
+        // This touches every accessible page, so it trades lazily committed memory for an exact measurement
+        memset(stack->low, STACK_CANARY, stack->top - stack->low);
+    }
+
+    return true;
+}
+
+/**
+ * Keep a stack for reuse, or unmap it if enough are kept already. With huge pages it goes back on the free list
+ * with its memory, and otherwise its pages are dropped, so a kept stack costs no memory and measures from zero again.
+ */
+void stack_free(struct stack *const stack) {
+    if (config.huge_pages) {
+        *(char **) (stack->top - sizeof(char *)) = huge_free_list;
+        huge_free_list = stack->top;
+        return;
+    }
+    if (kept_count < STACKS_KEPT && madvise(stack->low, stack->top - stack->low, MADV_DONTNEED) == 0) {
+        kept[kept_count++] = *stack;
+        return;
+    }
+    munmap(stack->base, stack->top - stack->base);
+}
+
+/**
+ * Measure how deep a stack has ever been used.
+ * @return The high-water mark in bytes, exact with canaries and rounded up to a page without. Without canaries,
+ *         a huge page stack is measured to the huge page, and includes what earlier tasks on it used.
+ */
+size_t stack_used(const struct stack *const stack) {
+    if (config.canary) {
+        const char *p = stack->low;
+        while (p < stack->top && *p == STACK_CANARY) {
+            p++;
+        }
+        return stack->top - p;
+    }
+
+    // Pages that were never touched are not resident, so the lowest resident page is the high-water mark
+    unsigned char resident[256];
+    char *p = stack->low;
+    while (p < stack->top) {
+        size_t pages = (stack->top - p) / page_size;
+        if (pages > sizeof(resident)) {
+            pages = sizeof(resident);
+        }
+        if (mincore(p, pages * page_size, resident) != 0) {
+            return stack->top - stack->low;
+        }
+        for (size_t i = 0; i < pages; i++) {
+            if (resident[i] & 1) {
+                return stack->top - (p + i * page_size);
+            }
+        }
+        p += pages * page_size;
+    }
+    return 0;
+}
+
+void stack_set_running(struct stack *const stack) {
+    running_stack = stack;
+}
@@ -0,0 +1,40 @@
+#ifndef __SUT_STACK_H__
+#define __SUT_STACK_H__
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * A task stack. The mapping starts at base with a guard page, and the usable region runs up to top, of which only
+ * [low, top) is accessible. Growable stacks move low down on demand.
+ */
+struct stack {
+    char *base;
+    char *low;
+    char *top;
+};
+
+/**
+ * How task stacks are allocated.
+ */
+struct stack_config {
+    // Usable bytes per stack, not counting the guard page
+    size_t size;
+    // Bytes accessible when the task starts; less than size makes stacks grow on demand, 0 means all of it
+    size_t initial;
+    // Fill stacks with a pattern, so usage is measured to the byte instead of to the page
+    bool canary;
+    // NUMA node stacks are preferably placed on, or -1 for first touch
+    int node;
+    // Carve stacks out of transparent huge pages, recycling them instead of unmapping them on free
+    bool huge_pages;
+};
+
+void stack_configure(const struct stack_config *config);
+void stack_thread_init();
+bool stack_alloc(struct stack *stack);
+void stack_free(struct stack *stack);
+size_t stack_used(const struct stack *stack);
+void stack_set_running(struct stack *stack);
+void stack_shutdown();
+
+#endif
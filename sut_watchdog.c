@@ -0,0 +1,152 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <execinfo.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "sut_watchdog.h"
+
+#define WATCHDOG_SIGNAL (SIGRTMIN + 1)
+#define BACKTRACE_DEPTH 64
+
+pthread_t watchdog, watched;
+bool watchdog_enabled, watchdog_stopping;
+long threshold_ns;
+// What the executor is running, under a seqlock: dispatch_seq is odd while the rest are being written and bumped
+// again after, so the watchdog can tell a consistent snapshot from one taken mid-update, and a long dispatch from
+// several short ones.
+unsigned long dispatch_seq, running_id;
+void *running_entry;
+long dispatch_start;
+
+/**
+ * Read the monotonic clock.
+ * @return The time in nanoseconds.
+ */
+long now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+/**
+ * Runs on the executor thread when the watchdog signals it, so the backtrace is of the stalled task.
+ */
+void on_watchdog_signal(__attribute__((unused)) int sig) {
+    void *frames[BACKTRACE_DEPTH];
+    const int depth = backtrace(frames, BACKTRACE_DEPTH);
+    backtrace_symbols_fd(frames, depth, STDERR_FILENO);
+}
+
+void *watchdog_execute(__attribute__((unused)) void *arg) {
+    unsigned long reported = 0;
+    // Check a few times per threshold, so a stall is reported soon after it crosses it
+    const long period_ns = threshold_ns / 4;
+    const struct timespec period = {period_ns / 1000000000L, period_ns % 1000000000L};
+    while (!__atomic_load_n(&watchdog_stopping, __ATOMIC_ACQUIRE)) {
+        nanosleep(&period, NULL);
+
+        unsigned long seq, id;
+        void *entry;
+        long start;
+        // The executor is only ever a few stores into an update, so just try again until one is read whole
+        do {
+            seq = __atomic_load_n(&dispatch_seq, __ATOMIC_ACQUIRE);
+            id = __atomic_load_n(&running_id, __ATOMIC_RELAXED);
+            entry = __atomic_load_n(&running_entry, __ATOMIC_RELAXED);
+            start = __atomic_load_n(&dispatch_start, __ATOMIC_RELAXED);
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        } while (seq % 2 != 0 || seq != __atomic_load_n(&dispatch_seq, __ATOMIC_RELAXED));
+        if (id == 0 || seq == reported) {
+            continue;
+        }
+
+        const long held = now_ns() - start;
+        if (held >= threshold_ns) {
+            reported = seq;
+            fprintf(stderr, "sut: task %lu has held the compute executor for %ld ms, entry function:\n", id,
+                    held / 1000000);
+            void *frames[] = {entry};
+            backtrace_symbols_fd(frames, 1, STDERR_FILENO);
+            pthread_kill(watched, WATCHDOG_SIGNAL);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Start watching an executor thread for tasks that hold it for longer than the threshold.
+ * @param executor The executor thread, which gets signalled to print its backtrace.
+ * @param threshold_ms How long a single dispatch may run, or 0 to not watch at all.
+ */
+void watchdog_start(const pthread_t executor, const unsigned int threshold_ms) {
+    if (threshold_ms == 0) {
+        return;
+    }
+
+    // backtrace loads its unwinder on first use, which isn't safe inside a signal handler
+    void *frames[1];
+    backtrace(frames, 1);
+    // Restart interrupted syscalls, so that being watched doesn't make a blocking read, write or wait fail with EINTR.
+    // Sleeps such as nanosleep and poll are never restarted, and still return EINTR.
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = on_watchdog_signal;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(WATCHDOG_SIGNAL, &action, NULL);
+
+    watched = executor;
+    threshold_ns = threshold_ms * 1000000L;
+    watchdog_stopping = false;
+    watchdog_enabled = true;
+    pthread_create(&watchdog, NULL, watchdog_execute, NULL);
+}
+
+/**
+ * Make dispatch_seq odd before the executor rewrites what it is running; only the executor writes it.
+ */
+void begin_update() {
+    __atomic_store_n(&dispatch_seq, dispatch_seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+/**
+ * Record that the executor has started running a task.
+ */
+void watchdog_dispatch(const unsigned long task_id, void *const entry) {
+    if (!watchdog_enabled) {
+        return;
+    }
+    const long start = now_ns();
+    begin_update();
+    __atomic_store_n(&running_id, task_id, __ATOMIC_RELAXED);
+    __atomic_store_n(&running_entry, entry, __ATOMIC_RELAXED);
+    __atomic_store_n(&dispatch_start, start, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&dispatch_seq, 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Record that the executor is back in its scheduler.
+ */
+void watchdog_idle() {
+    if (!watchdog_enabled) {
+        return;
+    }
+    begin_update();
+    __atomic_store_n(&running_id, 0, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&dispatch_seq, 1, __ATOMIC_RELEASE);
+}
+
+void watchdog_stop() {
+    if (!watchdog_enabled) {
+        return;
+    }
+    __atomic_store_n(&watchdog_stopping, true, __ATOMIC_RELEASE);
+    pthread_join(watchdog, NULL);
+    watchdog_enabled = false;
+}
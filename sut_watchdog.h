@@ -0,0 +1,12 @@
+#ifndef __SUT_WATCHDOG_H__
+#define __SUT_WATCHDOG_H__
+#include <pthread.h>
+
+void watchdog_start(pthread_t executor, unsigned int threshold_ms);
+void watchdog_dispatch(unsigned long task_id, void *entry);
+void watchdog_idle();
+void watchdog_stop();
+// The monotonic clock in nanoseconds, which the executors also use to account their idle time.
+long now_ns();
+
+#endif
@@ -0,0 +1,78 @@
+#include "sut.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#define TASKS 256
+#define ROUNDS 100
+
+const char *mode;
+// Keeps the compiler from dropping the stack writes
+char *volatile sink;
+
+double clock_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1e9 + now.tv_nsec;
+}
+
+void worker() {
+    // Touch a few pages of stack, so each switch lands on memory that isn't in the TLB
+    char frame[16 * 1024];
+    memset(frame, 1, sizeof(frame));
+    sink = frame;
+    int i;
+    for (i = 0; i < ROUNDS; i++) {
+        sut_yield();
+    }
+    sut_exit();
+}
+
+void launcher() {
+    // The first wave warms up the allocator, and the second is timed, creation and exit included
+    double started = 0;
+    int wave, i;
+    for (wave = 0; wave < 2; wave++) {
+        started = clock_ns();
+        struct sut_group *const group = sut_group_create();
+        for (i = 0; i < TASKS; i++) {
+            sut_group_spawn(group, worker);
+        }
+        sut_group_wait(group);
+        sut_group_destroy(group);
+    }
+    const double elapsed = clock_ns() - started;
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    printf("%-10s %10.1f ns/switch %10ld KiB peak RSS\n", mode, elapsed / (TASKS * ROUNDS), usage.ru_maxrss);
+    sut_exit();
+}
+
+void bench(const bool huge_pages) {
+    struct sut_attr attr;
+    sut_attr_init(&attr);
+    attr.stack_huge_pages = huge_pages;
+    sut_init_attr(&attr);
+    mode = huge_pages ? "huge pages" : "mmap";
+    sut_create(launcher);
+    sut_shutdown();
+}
+
+int main() {
+    // Each mode runs in its own process, so the peak RSS of one doesn't hide the other's
+    int huge_pages;
+    for (huge_pages = 0; huge_pages <= 1; huge_pages++) {
+        fflush(stdout);
+        const pid_t pid = fork();
+        if (pid == 0) {
+            bench(huge_pages);
+            return 0;
+        }
+        waitpid(pid, NULL, 0);
+    }
+    return 0;
+}
@@ -0,0 +1,56 @@
+#define _GNU_SOURCE
+#include "sut.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+
+#define BLOCKS 4
+
+void hello1() {
+    int i;
+    // O_DIRECT needs aligned buffers, which the pool provides; filesystems without it (like tmpfs) fall back
+    int fd = sut_open_ex("./test11.txt", O_RDWR | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+    if (fd == -EINVAL) {
+        fd = sut_open_ex("./test11.txt", O_RDWR | O_CREAT | O_TRUNC, 0644);
+    }
+    if (fd < 0) {
+        printf("Error: sut_open_ex() failed\n");
+        sut_exit();
+    }
+
+    const int size = (int) sut_buf_size();
+    for (i = 0; i < BLOCKS; i++) {
+        char *const buf = (char *) sut_buf_get();
+        memset(buf, 'a' + i, size);
+        if (sut_pwrite(fd, buf, size, (off_t) i * size) != size) {
+            printf("Error: sut_pwrite() failed\n");
+        }
+        sut_buf_put(buf);
+    }
+
+    char *bufs[BLOCKS];
+    for (i = 0; i < BLOCKS; i++) {
+        bufs[i] = (char *) sut_buf_get();
+    }
+    if (sut_buf_get() != NULL) {
+        printf("Error: the pool handed out more buffers than it has\n");
+    }
+    for (i = 0; i < BLOCKS; i++) {
+        if (sut_pread(fd, bufs[i], size, (off_t) i * size) == size && bufs[i][size - 1] == 'a' + i) {
+            printf("Hello world!, block %d read back\n", i);
+        }
+        sut_buf_put(bufs[i]);
+    }
+    sut_close(fd);
+    sut_exit();
+}
+
+int main() {
+    struct sut_attr attr;
+    sut_attr_init(&attr);
+    attr.io_buf_count = BLOCKS;
+    sut_init_attr(&attr);
+    sut_create(hello1);
+    sut_shutdown();
+}
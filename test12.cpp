@@ -0,0 +1,51 @@
+#include "sut.hpp"
+#include <cstdio>
+#include <cstring>
+
+sut::task count(int id) {
+    for (int i = 0; i < 3; i++) {
+        std::printf("Hello world!, this is coroutine SUT-%d with %d\n", id, i);
+        co_await sut::yield();
+    }
+}
+
+sut::task write_file(const char *message) {
+    char file_name[] = "./test12.txt";
+    const int fd = (int) co_await sut::open(file_name);
+    if (fd < 0) {
+        std::printf("Error: sut::open() failed\n");
+        co_return;
+    }
+    char sbuf[128];
+    for (int i = 0; i < 5; i++) {
+        std::snprintf(sbuf, sizeof(sbuf), "%s i = %d \n", message, i);
+        co_await sut::write(fd, sbuf, (int) std::strlen(sbuf));
+    }
+    co_await sut::close(fd);
+}
+
+sut::task parent() {
+    co_await sut::spawn(write_file("Hello world!, message from a coroutine")).join();
+    std::printf("Hello world!, the coroutine writer finished\n");
+}
+
+// A stackful C-style task can start coroutines and wait for them too
+void hello1() {
+    // sut_exit never returns, so the handle is scoped to be destroyed before it
+    {
+        sut::join_handle writer = sut::spawn(count(-1));
+        writer.wait();
+    }
+    std::printf("Hello world!, the stackful task waited for a coroutine\n");
+    sut_exit();
+}
+
+int main() {
+    sut_init();
+    sut::spawn(parent());
+    sut_create(hello1);
+    for (int i = 0; i < 100; i++) {
+        sut::spawn(count(i));
+    }
+    sut_shutdown();
+}
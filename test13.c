@@ -0,0 +1,48 @@
+#include "sut.h"
+#include <pthread.h>
+#include <stdio.h>
+
+#define POSTS 10000
+
+struct sut_mailbox *mailbox;
+
+// A plain pthread, outside the runtime, handing work to a task
+void *poster(__attribute__((unused)) void *arg) {
+    int i;
+    for (i = 0; i < POSTS; i++) {
+        sut_post(mailbox, 1);
+    }
+    return NULL;
+}
+
+void hello1() {
+    unsigned long received = 0;
+    int wakeups = 0;
+    while (received < POSTS) {
+        received += sut_mailbox_wait(mailbox);
+        wakeups++;
+    }
+    printf("Hello world!, received %lu posts in %s wakeups\n", received, wakeups < POSTS ? "fewer" : "as many");
+    sut_exit();
+}
+
+void hello2() {
+    int i;
+    for (i = 0; i < 10; i++) {
+        printf("Hello world!, this is SUT-Two \n");
+        sut_yield();
+    }
+    sut_exit();
+}
+
+int main() {
+    pthread_t thread;
+    sut_init();
+    mailbox = sut_mailbox_create();
+    sut_create(hello1);
+    sut_create(hello2);
+    pthread_create(&thread, NULL, poster, NULL);
+    sut_shutdown();
+    pthread_join(thread, NULL);
+    sut_mailbox_destroy(mailbox);
+}
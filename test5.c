@@ -43,9 +43,9 @@ void hello3() {
     if (fd < 0)
         printf("Error: sut_open() failed in hello3()");
     else {
-        char *read_result = sut_read(fd, read_sbuf, buf_size);
-        if (read_result != NULL) {
-            printf(read_sbuf);
+        int read_result = sut_read(fd, read_sbuf, buf_size);
+        if (read_result >= 0) {
+            printf("%.*s", read_result, read_sbuf);
             sut_close(fd);
         } else {
             printf("Error: sut_read() failed");
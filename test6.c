@@ -0,0 +1,43 @@
+#include "sut.h"
+#include <stdio.h>
+
+struct sut_task *producer_task, *consumer_task;
+int slot;
+bool done = false;
+
+void consumer() {
+    while (!done) {
+        printf("Hello world!, consumer got %d\n", slot);
+        sut_park_and_switch_to(producer_task);
+    }
+    sut_exit();
+}
+
+void producer() {
+    int i;
+    producer_task = sut_self();
+    consumer_task = sut_spawn(consumer);
+    for (i = 0; i < 100; i++) {
+        slot = i;
+        sut_park_and_switch_to(consumer_task);
+    }
+    done = true;
+    sut_unpark(consumer_task);
+    sut_exit();
+}
+
+void hello2() {
+    int i;
+    for (i = 0; i < 100; i++) {
+        printf("Hello world!, this is SUT-Two with %d\n", i);
+        sut_yield();
+    }
+    sut_exit();
+}
+
+int main() {
+    sut_init();
+    sut_create(producer);
+    sut_create(hello2);
+    sut_shutdown();
+}
@@ -0,0 +1,64 @@
+#include "sut.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct counter {
+    int id;
+    int i;
+};
+
+struct writer {
+    int stage;
+    int fd;
+    int i;
+    char sbuf[128];
+};
+
+enum sut_step count(void *state) {
+    struct counter *const c = (struct counter *) state;
+    if (c->i == 3) {
+        free(c);
+        return SUT_STEP_EXIT;
+    }
+    printf("Hello world!, this is stackless SUT-%d with %d\n", c->id, c->i++);
+    return SUT_STEP_YIELD;
+}
+
+enum sut_step write_file(void *state) {
+    struct writer *const w = (struct writer *) state;
+    switch (w->stage++) {
+        case 0:
+            return sut_step_open("./test7.txt");
+        case 1:
+            w->fd = (int) sut_step_result();
+            if (w->fd < 0) {
+                printf("Error: sut_step_open() failed\n");
+                return SUT_STEP_EXIT;
+            }
+            // fall through
+        default:
+            if (w->i == 5) {
+                w->stage = -1;
+                return sut_step_close(w->fd);
+            }
+            sprintf(w->sbuf, "Hello world!, message from stackless SUT i = %d \n", w->i++);
+            return sut_step_write(w->fd, w->sbuf, strlen(w->sbuf));
+        case -1:
+            return SUT_STEP_EXIT;
+    }
+}
+
+int main() {
+    int i;
+    struct writer w = {0};
+    sut_init();
+    sut_create_stackless(write_file, &w);
+    for (i = 0; i < 1000; i++) {
+        struct counter *const c = (struct counter *) malloc(sizeof(struct counter));
+        c->id = i;
+        c->i = 0;
+        sut_create_stackless(count, c);
+    }
+    sut_shutdown();
+}
@@ -0,0 +1,48 @@
+#include "sut.h"
+#include <stdio.h>
+
+int finished = 0;
+
+void worker() {
+    int i;
+    for (i = 0; i < 10; i++) {
+        sut_yield();
+    }
+    finished++;
+    sut_exit();
+}
+
+void straggler() {
+    int i;
+    for (i = 0; i < 1000; i++) {
+        sut_yield();
+    }
+    printf("Error: straggler was not cancelled\n");
+    sut_exit();
+}
+
+void hello1() {
+    int i;
+    struct sut_group *const group = sut_group_create();
+    for (i = 0; i < 5; i++) {
+        sut_group_spawn(group, worker);
+    }
+    if (sut_group_wait(group) == 0) {
+        printf("Hello world!, all %d workers finished\n", finished);
+    }
+
+    sut_group_spawn(group, straggler);
+    sut_yield();
+    sut_group_cancel(group);
+    if (sut_group_wait(group) < 0) {
+        printf("Hello world!, straggler was cancelled\n");
+    }
+    sut_group_destroy(group);
+    sut_exit();
+}
+
+int main() {
+    sut_init();
+    sut_create(hello1);
+    sut_shutdown();
+}
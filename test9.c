@@ -0,0 +1,96 @@
+#include "sut.h"
+#include <stdio.h>
+#include <string.h>
+
+#define RUNS 1000
+
+char trace[4096];
+int trace_len;
+int finished;
+
+void note(char c) {
+    if (trace_len < (int) sizeof(trace) - 1) {
+        trace[trace_len++] = c;
+    }
+}
+
+void hello3() {
+    int fd;
+    char read_sbuf[256];
+    fd = sut_open("./test9.txt");
+    sut_yield();
+    if (fd >= 0 && sut_read(fd, read_sbuf, sizeof(read_sbuf)) >= 0) {
+        note('r');
+        sut_close(fd);
+    }
+    finished++;
+    sut_exit();
+}
+
+void hello1() {
+    int i, fd;
+    char write_sbuf[128];
+    fd = sut_open("./test9.txt");
+    if (fd >= 0) {
+        for (i = 0; i < 5; i++) {
+            sprintf(write_sbuf, "Hello world!, message from SUT-One i = %d \n", i);
+            sut_write(fd, write_sbuf, strlen(write_sbuf));
+            note('w');
+            sut_yield();
+        }
+        sut_close(fd);
+        sut_create(hello3);
+    }
+    finished++;
+    sut_exit();
+}
+
+void hello2() {
+    int i;
+    for (i = 0; i < 10; i++) {
+        note('y');
+        sut_yield();
+    }
+    finished++;
+    sut_exit();
+}
+
+/**
+ * Run the workload once under a deterministic schedule.
+ * @return true if every task finished.
+ */
+bool run(unsigned long seed, const char *record, const char *replay) {
+    struct sut_attr attr;
+    sut_attr_init(&attr);
+    attr.deterministic = true;
+    attr.sim_seed = seed;
+    attr.sim_record = record;
+    attr.sim_replay = replay;
+    trace_len = 0;
+    finished = 0;
+    remove("./test9.txt");
+
+    sut_init_attr(&attr);
+    sut_create(hello1);
+    sut_create(hello2);
+    sut_shutdown();
+    trace[trace_len] = '\0';
+    return finished == 3;
+}
+
+int main() {
+    unsigned long seed;
+    int passed = 0;
+    char recorded[sizeof(trace)];
+
+    for (seed = 1; seed <= RUNS; seed++) {
+        passed += run(seed, NULL, NULL);
+    }
+    printf("%d of %d seeded interleavings finished\n", passed, RUNS);
+
+    run(42, "./test9.schedule", NULL);
+    strcpy(recorded, trace);
+    run(7, NULL, "./test9.schedule");
+    printf("Replaying seed 42 %s the recorded interleaving\n", strcmp(recorded, trace) == 0 ? "reproduced" : "diverged from");
+    return 0;
+}